@@ -0,0 +1,218 @@
+#pragma once
+#include "configuration.hpp"
+#include "Particle.hpp"
+#include "hashGrid.hpp"
+
+// Puts grid cells whose particles have settled to sleep. Sleeping particles keep their
+// density, pressure and position, and are skipped by the density and force passes.
+// A particle is quiet when its velocity and its change of acceleration, averaged over
+// about sleepSteps steps, are small. Per step both carry the solver noise, and particles
+// resting on a wall bounce, but the averages settle.
+
+struct ActivityTracker
+{
+    private:
+        uint32_t const n_cells = conf::n_collumns * conf::n_rows;
+
+        std::vector<uint32_t> quietSteps;
+        std::vector<uint32_t> population;
+        std::vector<uint32_t> lastPopulation;
+        std::vector<uint8_t> asleep;
+        std::vector<uint8_t> disturbed;
+        std::vector<sf::Vector2f> lastAcceleration;
+        std::vector<sf::Vector2f> averageVelocity;
+        std::vector<sf::Vector2f> averageJerk;
+        uint32_t n_sleeping = 0;
+
+    private:
+        static bool onGrid(sf::Vector2f pos);
+        void wakeNeighbors(uint32_t hash);
+
+    public:
+        bool enabled = conf::sleepEnabled;
+        float auditError = 0.f; // Max density deviation of sleeping particles against the full solve, relative to rho_0
+
+    public:
+        ActivityTracker();
+        bool isCellAsleep(uint32_t hash) const;
+        bool isAsleep(const Particle& particle) const;
+        bool anyAsleep() const;
+        float sleepingFraction(uint32_t n_particles) const;
+        void update(const std::vector<Particle>& particles);
+        void audit(const std::vector<Particle>& particles, const std::vector<float>& fullDensities, const PhysicsParams& params);
+        void wakeAll();
+        void wakeAround(sf::Vector2f pos);
+        void moveParticle(uint32_t from, uint32_t to);
+};
+
+ActivityTracker::ActivityTracker()
+    : quietSteps(n_cells, 0), population(n_cells, 0), lastPopulation(n_cells, 0), asleep(n_cells, 0), disturbed(n_cells, 0)
+{
+}
+
+bool ActivityTracker::onGrid(sf::Vector2f pos)
+{
+    return pos.x >= 0.f && pos.y >= 0.f && pos.x < conf::cellSize * conf::n_collumns && pos.y < conf::cellSize * conf::n_rows;
+}
+
+bool ActivityTracker::isCellAsleep(uint32_t hash) const
+{
+    return hash < n_cells && asleep[hash];
+}
+
+bool ActivityTracker::isAsleep(const Particle& particle) const
+{
+    sf::Vector2f pos = particle.getPosition();
+    return onGrid(pos) && asleep[HashGrid::getHashFromPos(pos)];
+}
+
+bool ActivityTracker::anyAsleep() const
+{
+    return n_sleeping > 0;
+}
+
+float ActivityTracker::sleepingFraction(uint32_t n_particles) const
+{
+    if (n_particles == 0)
+        return 0.f;
+
+    uint32_t count = 0;
+
+    for (uint32_t hash{ n_cells }; hash--; )
+    {
+        if (asleep[hash])
+            count += population[hash];
+    }
+    return (float)count / n_particles;
+}
+
+// Called once per step, after integration
+
+void ActivityTracker::update(const std::vector<Particle>& particles)
+{
+    if (!enabled)
+        return;
+
+    lastAcceleration.resize(particles.size(), { 0.f, conf::g });
+    averageVelocity.resize(particles.size(), { 0.f, 0.f });
+    averageJerk.resize(particles.size(), { 0.f, 0.f });
+    float const rate = 1.f / conf::sleepSteps;
+    std::swap(population, lastPopulation);
+    std::fill(population.begin(), population.end(), 0);
+    std::fill(disturbed.begin(), disturbed.end(), 0);
+
+    for (uint32_t i{ (uint32_t)particles.size() }; i--; )
+    {
+        sf::Vector2f pos = particles[i].getPosition();
+
+        if (!onGrid(pos))
+            continue;
+
+        uint32_t hash = HashGrid::getHashFromPos(pos);
+        population[hash]++;
+
+        if (asleep[hash])
+            continue;
+
+        sf::Vector2f da = particles[i].getAcceleration() - lastAcceleration[i];
+        lastAcceleration[i] = particles[i].getAcceleration();
+
+        averageVelocity[i] += rate * (particles[i].getVelocity() - averageVelocity[i]);
+        averageJerk[i] += rate * (da - averageJerk[i]);
+
+        float speed = std::sqrt(averageVelocity[i].x * averageVelocity[i].x + averageVelocity[i].y * averageVelocity[i].y);
+        float jerk = std::sqrt(averageJerk[i].x * averageJerk[i].x + averageJerk[i].y * averageJerk[i].y);
+
+        if (speed > conf::sleepVelocity || jerk > conf::sleepAcceleration)
+            disturbed[hash] = 1;
+    }
+
+    // Particles crossing into a sleeping cell, or a disturbed neighbor, wake it up
+
+    for (uint32_t hash{ n_cells }; hash--; )
+    {
+        if (asleep[hash] && population[hash] != lastPopulation[hash])
+            asleep[hash] = 0;
+
+        if (!asleep[hash] && disturbed[hash])
+            wakeNeighbors(hash);
+    }
+
+    n_sleeping = 0;
+
+    for (uint32_t hash{ n_cells }; hash--; )
+    {
+        if (!asleep[hash])
+        {
+            quietSteps[hash] = disturbed[hash] ? 0 : quietSteps[hash] + 1;
+
+            if (quietSteps[hash] >= conf::sleepSteps && population[hash] > 0)
+                asleep[hash] = 1;
+        }
+        n_sleeping += asleep[hash];
+    }
+}
+
+void ActivityTracker::wakeNeighbors(uint32_t hash)
+{
+    int32_t x = hash % conf::n_collumns;
+    int32_t y = hash / conf::n_collumns;
+
+    for (int32_t dy = -1; dy <= 1; dy++)
+    {
+        for (int32_t dx = -1; dx <= 1; dx++)
+        {
+            int32_t nx = x + dx;
+            int32_t ny = y + dy;
+
+            if (nx < 0 || ny < 0 || nx >= (int32_t)conf::n_collumns || ny >= (int32_t)conf::n_rows)
+                continue;
+
+            uint32_t neighborHash = nx + conf::n_collumns * ny;
+            asleep[neighborHash] = 0;
+            quietSteps[neighborHash] = 0;
+        }
+    }
+}
+
+void ActivityTracker::audit(const std::vector<Particle>& particles, const std::vector<float>& fullDensities, const PhysicsParams& params)
+{
+    auditError = 0.f;
+    float rho_0 = params.rho_0();
+
+    for (uint32_t i{ (uint32_t)particles.size() }; i--; )
+    {
+        if (!isAsleep(particles[i]))
+            continue;
+
+        float error = std::abs(Particle::densityFromSum(fullDensities[i], params) - particles[i].getDensity()) / rho_0;
+        auditError = std::max(auditError, error);
+    }
+}
+
+void ActivityTracker::wakeAll()
+{
+    std::fill(asleep.begin(), asleep.end(), 0);
+    std::fill(quietSteps.begin(), quietSteps.end(), 0);
+    n_sleeping = 0;
+}
+
+// Particles spawned or deleted inside a sleeping region change the densities around them
+
+void ActivityTracker::wakeAround(sf::Vector2f pos)
+{
+    if (onGrid(pos))
+        wakeNeighbors(HashGrid::getHashFromPos(pos));
+}
+
+// Keeps the per particle history in step with the compaction of the particle array
+
+void ActivityTracker::moveParticle(uint32_t from, uint32_t to)
+{
+    if (from < lastAcceleration.size() && to < lastAcceleration.size())
+    {
+        lastAcceleration[to] = lastAcceleration[from];
+        averageVelocity[to] = averageVelocity[from];
+        averageJerk[to] = averageJerk[from];
+    }
+}
@@ -0,0 +1,298 @@
+#pragma once
+#include "configuration.hpp"
+#include "Particle.hpp"
+#include "hashGrid.hpp"
+#include "GlobalInteraction.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#if defined(__F16C__) || defined(__AVX2__)
+#define COMPACT_STATE_F16C
+#include <immintrin.h>
+#endif
+
+// Packed copy of the state the pair kernels read, 14 bytes per particle read in place of the 36 of
+// Particle. Positions are fixed point offsets from their grid cell and velocity, density and
+// pressure are half precision. Particle stays the integration state, since half precision
+// cannot hold the per step velocity increments, so the records are refreshed every step and
+// decoded to float inside the kernels, where the sums are accumulated.
+
+namespace half
+{
+    float const max = 65504.f; // Largest finite half
+
+    uint16_t fromFloat(float value);
+    float toFloat(uint16_t bits);
+}
+
+struct CompactParticle
+{
+    uint8_t cellX; // Cell the offsets are relative to, grids up to 256 x 256 cells
+    uint8_t cellY;
+    int16_t offsetX; // compactOffsetScale units per cell, reaching two cells to each side. outOfRange past that
+    int16_t offsetY;
+    uint16_t vx;
+    uint16_t vy;
+    uint16_t rho;
+    uint16_t P;
+};
+
+static_assert(sizeof(CompactParticle) == 14, "CompactParticle should stay packed");
+
+struct DecodedState
+{
+    sf::Vector2f v;
+    float rho;
+    float P;
+};
+
+class CompactState
+{
+public:
+    static int16_t const outOfRange = INT16_MIN; // Offset of particles too far outside the window, the kernels skip them
+
+public:
+    CompactState();
+    void pack(const std::vector<Particle>& particles);
+    void packDensityAndPressure(uint32_t idx, const Particle& particle);
+    bool inRange(uint32_t idx) const;
+    sf::Vector2f separation(uint32_t idx_i, uint32_t idx_j) const;
+    DecodedState decode(uint32_t idx) const;
+
+private:
+    static int16_t toFixed(float offset);
+
+private:
+    std::vector<CompactParticle> records;
+};
+
+// Round to nearest even. Uses F16C when the build enables it, the software path gives the same bits
+
+uint16_t half::fromFloat(float value)
+{
+#ifdef COMPACT_STATE_F16C
+    return _cvtss_sh(value, 0);
+#else
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t absx = x & 0x7fffffff;
+
+    if (absx >= 0x7f800000) // Inf and NaN
+        return sign | 0x7c00 | (absx > 0x7f800000 ? 0x200 : 0);
+
+    if (absx >= 0x477ff000) // Rounds above 65504
+        return sign | 0x7c00;
+
+    if (absx < 0x38800000) // Subnormal half
+    {
+        if (absx < 0x33000000)
+            return sign;
+
+        uint32_t mantissa = (absx & 0x7fffff) | 0x800000;
+        uint32_t shift = 126 - (absx >> 23);
+        uint32_t bits = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+
+        if (rest > halfway || (rest == halfway && (bits & 1)))
+            bits++;
+        return sign | bits;
+    }
+
+    uint32_t bits = (absx >> 13) - ((127 - 15) << 10);
+    uint32_t rest = absx & 0x1fff;
+
+    if (rest > 0x1000 || (rest == 0x1000 && (bits & 1)))
+        bits++; // A carry into the exponent is still the right result
+    return sign | bits;
+#endif
+}
+
+float half::toFloat(uint16_t bits)
+{
+#ifdef COMPACT_STATE_F16C
+    return _cvtsh_ss(bits);
+#else
+    // Shifting the exponent and mantissa into place and scaling by 2^(127 - 15) rebiases normals and subnormals alike
+    uint32_t x = (uint32_t)(bits & 0x7fff) << 13;
+    float value;
+    std::memcpy(&value, &x, sizeof(value));
+    value *= 0x1p112f;
+
+    std::memcpy(&x, &value, sizeof(x));
+
+    if ((bits & 0x7c00) == 0x7c00) // Inf and NaN
+        x |= 0x7f800000;
+
+    x |= (uint32_t)(bits & 0x8000) << 16;
+    std::memcpy(&value, &x, sizeof(value));
+    return value;
+#endif
+}
+
+CompactState::CompactState()
+{
+    assert(conf::n_collumns <= 256 && conf::n_rows <= 256); // Cells are stored in a byte
+}
+
+// Border cells hold the particles outside the window, so only those more than about a cell out
+// get past two cells of offset. NaN positions are flagged too.
+
+int16_t CompactState::toFixed(float offset)
+{
+    float fixed = std::round(offset * conf::compactOffsetScale / conf::cellSize);
+
+    if (!(std::abs(fixed) <= 32767.f))
+        return outOfRange;
+    return (int16_t)fixed;
+}
+
+// Density and pressure of the particles the step does not recompute, like sleeping ones, come along here
+
+void CompactState::pack(const std::vector<Particle>& particles)
+{
+    records.resize(particles.size());
+
+    for (uint32_t i{ (uint32_t)particles.size() }; i--; )
+    {
+        sf::Vector2f pos = particles[i].getPosition();
+        sf::Vector2f vel = particles[i].getVelocity();
+        uint32_t hash = HashGrid::getHashFromPos(pos);
+        CompactParticle& record = records[i];
+
+        record.cellX = hash % conf::n_collumns;
+        record.cellY = hash / conf::n_collumns;
+        record.offsetX = toFixed(pos.x - (float)record.cellX * conf::cellSize);
+        record.offsetY = toFixed(pos.y - (float)record.cellY * conf::cellSize);
+        record.vx = half::fromFloat(vel.x);
+        record.vy = half::fromFloat(vel.y);
+
+        packDensityAndPressure(i, particles[i]);
+    }
+}
+
+// Saturated instead of rounding to infinity. The Tait pressure passes 65504 at about 2.65 rho_0 for gamma = 7
+
+void CompactState::packDensityAndPressure(uint32_t idx, const Particle& particle)
+{
+    records[idx].rho = half::fromFloat(std::clamp(particle.getDensity(), -half::max, half::max));
+    records[idx].P = half::fromFloat(std::clamp(particle.getPressure(), -half::max, half::max));
+}
+
+bool CompactState::inRange(uint32_t idx) const
+{
+    return records[idx].offsetX != outOfRange && records[idx].offsetY != outOfRange;
+}
+
+// r_j - r_i. Cells and offsets are subtracted as integers, so the difference keeps the full fixed point resolution
+
+sf::Vector2f CompactState::separation(uint32_t idx_i, uint32_t idx_j) const
+{
+    const CompactParticle& a = records[idx_i];
+    const CompactParticle& b = records[idx_j];
+    float unit = (float)conf::cellSize / conf::compactOffsetScale;
+
+    int32_t dx = ((int32_t)b.cellX - a.cellX) * (int32_t)conf::compactOffsetScale + b.offsetX - a.offsetX;
+    int32_t dy = ((int32_t)b.cellY - a.cellY) * (int32_t)conf::compactOffsetScale + b.offsetY - a.offsetY;
+
+    return { dx * unit, dy * unit };
+}
+
+// Velocity, density and pressure are contiguous, so F16C converts the four of them at once
+
+DecodedState CompactState::decode(uint32_t idx) const
+{
+    const CompactParticle& record = records[idx];
+
+#ifdef COMPACT_STATE_F16C
+    float values[4];
+    _mm_storeu_ps(values, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)&record.vx)));
+    return { { values[0], values[1] }, values[2], values[3] };
+#else
+    return { { half::toFloat(record.vx), half::toFloat(record.vy) }, half::toFloat(record.rho), half::toFloat(record.P) };
+#endif
+}
+
+// Same kernels as DensityCalculator and SPH, reading the records of state. The particles
+// argument is only there for the Action interface, nothing is read from it.
+
+struct CompactDensityCalculator : public Action<float>
+{
+    const CompactState* state = nullptr;
+
+    void doAction(const std::vector<Particle>&, std::vector<float>& output_v, const uint32_t idx_i, const uint32_t idx_j) const override
+    {
+        float rho_ij = contribution(idx_i, idx_j);
+
+        output_v[idx_i] += rho_ij;
+        output_v[idx_j] += rho_ij;
+    }
+
+    void doActionOnFirst(const std::vector<Particle>&, std::vector<float>& output_v, const uint32_t idx_i, const uint32_t idx_j) const override
+    {
+        output_v[idx_i] += contribution(idx_i, idx_j);
+    }
+
+    float contribution(const uint32_t idx_i, const uint32_t idx_j) const
+    {
+        if (!state->inRange(idx_i) || !state->inRange(idx_j))
+            return 0.f;
+
+        sf::Vector2f r_ij = state->separation(idx_i, idx_j);
+        float d_ij = std::sqrt(r_ij.x * r_ij.x + r_ij.y * r_ij.y);
+
+        if (d_ij < 2.f * params.h)
+        {
+            WKernel kernel{ params.h };
+            return conf::m_particle * kernel.W(d_ij);
+        }
+        return 0.f;
+    }
+};
+
+struct CompactSPH : public SPH
+{
+    const CompactState* state = nullptr;
+
+    void solve(const std::vector<Particle>&, std::vector<sf::Vector2f>& f_collisions, const uint32_t idx_i, const uint32_t idx_j) const override
+    {
+        sf::Vector2f f_pressure, f_viscosity;
+
+        if (forces(idx_i, idx_j, f_pressure, f_viscosity))
+        {
+            f_collisions[idx_i] += f_pressure + f_viscosity;
+            f_collisions[idx_j] -= f_pressure - f_viscosity;
+        }
+    }
+
+    void solveOnFirst(const std::vector<Particle>&, std::vector<sf::Vector2f>& f_collisions, const uint32_t idx_i, const uint32_t idx_j) const override
+    {
+        sf::Vector2f f_pressure, f_viscosity;
+
+        if (forces(idx_i, idx_j, f_pressure, f_viscosity))
+            f_collisions[idx_i] += f_pressure + f_viscosity;
+    }
+
+    bool forces(const uint32_t idx_i, const uint32_t idx_j, sf::Vector2f& f_pressure, sf::Vector2f& f_viscosity) const
+    {
+        if (!state->inRange(idx_i) || !state->inRange(idx_j))
+            return false;
+
+        sf::Vector2f r_ij = state->separation(idx_i, idx_j);
+        float d_ij = std::sqrt(r_ij.x * r_ij.x + r_ij.y * r_ij.y);
+
+        if (d_ij < 2.f * params.h)
+        {
+            DecodedState s_i = state->decode(idx_i);
+            DecodedState s_j = state->decode(idx_j);
+
+            pairForces(d_ij, r_ij / d_ij, s_i.P, s_i.rho, s_j.P, s_j.rho, s_i.v - s_j.v, f_pressure, f_viscosity);
+            return true;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,199 @@
+#pragma once
+#include "configuration.hpp"
+#include "Scene.hpp"
+#include "Observables.hpp"
+#include "ThreadPool.hpp"
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+// Runs many independent scenes with different physical parameters in one process.
+// Scenes are the unit of work; each one steps serially inside its own pool task.
+// The spring constant k is not swept, it only drives SpringLike and the scenes step with SPH.
+
+struct Sweep
+{
+    std::vector<float> alpha{ conf::alpha };
+    std::vector<float> beta{ conf::beta };
+    std::vector<float> alpha_v{ conf::alpha_v };
+    std::vector<float> gamma{ conf::gamma };
+    std::vector<float> h{ conf::h }; // Up to half a grid cell, the neighbor searches only look at the adjacent cells
+
+    std::vector<PhysicsParams> expand() const;
+};
+
+struct EnsembleResult
+{
+    PhysicsParams params;
+    uint32_t seed;
+    uint64_t steps;
+    float simTime;
+    float wallTime;
+    bool diverged; // A position or velocity went non finite, the scene stopped there
+    float divergedTime;
+    std::vector<float> values; // Last sample of every observable
+};
+
+class Ensemble
+{
+public:
+    Ensemble(ThreadPool& pool);
+    void add(const PhysicsParams& params, uint32_t seed = conf::ensembleSeed);
+    void add(const Sweep& sweep, uint32_t seed = conf::ensembleSeed);
+    std::vector<EnsembleResult> run(float simSeconds);
+    std::vector<std::string> getObservableNames() const;
+    void writeTable(std::ostream& os, const std::vector<EnsembleResult>& results) const;
+    static bool isFinite(const std::vector<Particle>& particles);
+
+private:
+    EnsembleResult runScene(const PhysicsParams& params, uint32_t seed, float simSeconds) const;
+
+private:
+    ThreadPool& pool;
+    std::vector<std::pair<PhysicsParams, uint32_t>> members;
+};
+
+std::vector<PhysicsParams> Sweep::expand() const
+{
+    std::vector<PhysicsParams> points;
+
+    for (float alpha_i : alpha)
+        for (float beta_i : beta)
+            for (float alpha_v_i : alpha_v)
+                for (float gamma_i : gamma)
+                    for (float h_i : h)
+                    {
+                        points.push_back({ alpha_i, beta_i, conf::k, alpha_v_i, gamma_i, h_i });
+                    }
+
+    return points;
+}
+
+Ensemble::Ensemble(ThreadPool& pool)
+    : pool(pool)
+{
+}
+
+// Kernels wider than the cells would miss neighbors two cells away, those scenes are left out
+
+void Ensemble::add(const PhysicsParams& params, uint32_t seed)
+{
+    if (params.h > 0.5f * conf::cellSize)
+    {
+        std::cerr << "Ensemble: h = " << params.h << " is larger than half a grid cell, scene skipped" << std::endl;
+        return;
+    }
+    members.push_back({ params, seed });
+}
+
+void Ensemble::add(const Sweep& sweep, uint32_t seed)
+{
+    for (const auto& params : sweep.expand())
+    {
+        add(params, seed);
+    }
+}
+
+std::vector<EnsembleResult> Ensemble::run(float simSeconds)
+{
+    std::vector<EnsembleResult> results(members.size());
+    TaskGroup group;
+
+    for (uint32_t i = 0; i < members.size(); i++)
+    {
+        pool.submit([this, &results, i, simSeconds] {
+            results[i] = runScene(members[i].first, members[i].second, simSeconds);
+        }, &group);
+    }
+    pool.wait(group);
+
+    return results;
+}
+
+EnsembleResult Ensemble::runScene(const PhysicsParams& params, uint32_t seed, float simSeconds) const
+{
+    auto start = std::chrono::steady_clock::now();
+
+    Scene scene(params, seed);
+    ObservablesPipeline observables(false);
+    observables.addDefaults();
+
+    bool diverged = false;
+
+    while (scene.time < simSeconds)
+    {
+        scene.step();
+
+        if (!isFinite(scene.particles))
+        {
+            diverged = true;
+            break;
+        }
+        observables.submit(scene);
+    }
+
+    float wallTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    EnsembleResult result{ params, seed, scene.stepCount, scene.time, wallTime, diverged, diverged ? scene.time : 0.f, {} };
+
+    for (uint32_t id = 0; id < observables.getObservables().size(); id++)
+    {
+        TimeSeries::Point point{ 0, 0.f, 0.f };
+        observables.series.latest(id, point);
+        result.values.push_back(point.value);
+    }
+    return result;
+}
+
+bool Ensemble::isFinite(const std::vector<Particle>& particles)
+{
+    for (const auto& particle : particles)
+    {
+        sf::Vector2f r = particle.getPosition();
+        sf::Vector2f v = particle.getVelocity();
+
+        if (!std::isfinite(r.x) || !std::isfinite(r.y) || !std::isfinite(v.x) || !std::isfinite(v.y))
+            return false;
+    }
+    return true;
+}
+
+std::vector<std::string> Ensemble::getObservableNames() const
+{
+    ObservablesPipeline observables(false);
+    observables.addDefaults();
+
+    std::vector<std::string> names;
+
+    for (const auto& observable : observables.getObservables())
+    {
+        names.push_back(observable.name);
+    }
+    return names;
+}
+
+// One row per scene, comma separated
+
+void Ensemble::writeTable(std::ostream& os, const std::vector<EnsembleResult>& results) const
+{
+    os << "alpha,beta,alpha_v,gamma,h,compact_state,seed,steps,sim_time,wall_time,diverged,diverged_time";
+
+    for (const auto& name : getObservableNames())
+    {
+        os << "," << name;
+    }
+    os << std::endl;
+
+    for (const auto& result : results)
+    {
+        const PhysicsParams& p = result.params;
+        os << p.alpha << "," << p.beta << "," << p.alpha_v << "," << p.gamma << "," << p.h << "," << p.compactState << ","
+           << result.seed << "," << result.steps << "," << result.simTime << "," << result.wallTime << ","
+           << result.diverged << "," << result.divergedTime;
+
+        for (float value : result.values)
+        {
+            os << "," << value;
+        }
+        os << std::endl;
+    }
+}
@@ -3,6 +3,8 @@
 #include "Particle.hpp"
 #include "hashGrid.hpp"
 #include "WKernel.hpp"
+#include "ActivityTracker.hpp"
+#include <algorithm>
 
 template <typename Detector, typename Action, typename Output>
 struct GlobalInteraction
@@ -19,7 +21,12 @@ struct GlobalInteraction
 template <typename Output>
 struct Action
 {
+    PhysicsParams params;
+
     virtual void doAction(const std::vector<Particle>& particles, std::vector<Output>& output_v, const uint32_t idx_i, const uint32_t idx_j) const = 0;
+
+    // Only writes to idx_i, for gather loops where every particle owns its output
+    virtual void doActionOnFirst(const std::vector<Particle>& particles, std::vector<Output>& output_v, const uint32_t idx_i, const uint32_t idx_j) const = 0;
 };
 
 struct DensityCalculator : public Action<float>
@@ -29,18 +36,31 @@ struct DensityCalculator : public Action<float>
         calculate(particles, output_v, idx_i, idx_j);
     }
 
+    void doActionOnFirst(const std::vector<Particle>& particles, std::vector<float>& output_v, const uint32_t idx_i, const uint32_t idx_j) const override
+    {
+        output_v[idx_i] += contribution(particles, idx_i, idx_j);
+    }
+
     void calculate(const std::vector<Particle>& particles, std::vector<float>& densities, const uint32_t idx_i, const uint32_t idx_j) const
+    {
+        float rho_ij = contribution(particles, idx_i, idx_j);
+
+        densities[idx_i] += rho_ij;
+        densities[idx_j] += rho_ij;
+    }
+
+    float contribution(const std::vector<Particle>& particles, const uint32_t idx_i, const uint32_t idx_j) const
     {
         float d_ij = distance(particles[idx_j].getPosition(), particles[idx_i].getPosition());
 
-        if (d_ij < 2.f * conf::h)
+        if (d_ij < 2.f * params.h)
         {
-            WKernel kernel;
+            WKernel kernel{ params.h };
             float W_ij = kernel.W(d_ij);
 
-            densities[idx_i] += conf::m_particle * W_ij;
-            densities[idx_j] += conf::m_particle * W_ij;
+            return conf::m_particle * W_ij;
         }
+        return 0.f;
     }
 };
 
@@ -50,24 +70,41 @@ struct Model : public Action<sf::Vector2f>
     {
         solve(particles, output_v, idx_i, idx_j);
     }
+
+    void doActionOnFirst(const std::vector<Particle>& particles, std::vector<sf::Vector2f>& output_v, const uint32_t idx_i, const uint32_t idx_j) const override
+    {
+        solveOnFirst(particles, output_v, idx_i, idx_j);
+    }
     
     virtual void solve(const std::vector<Particle>& particles, std::vector<sf::Vector2f>& f_collisions, const uint32_t idx_i, const uint32_t idx_j) const = 0;
+    virtual void solveOnFirst(const std::vector<Particle>& particles, std::vector<sf::Vector2f>& f_collisions, const uint32_t idx_i, const uint32_t idx_j) const = 0;
 };
 
 struct SpringLike : public Model
 {
     void solve(const std::vector<Particle>& particles, std::vector<sf::Vector2f>& f_collisions, const uint32_t idx_i, const uint32_t idx_j) const override
+    {
+        sf::Vector2f f_collision_i = force(particles, idx_i, idx_j);
+
+        f_collisions[idx_i] += f_collision_i;
+        f_collisions[idx_j] -= f_collision_i;
+    }
+
+    void solveOnFirst(const std::vector<Particle>& particles, std::vector<sf::Vector2f>& f_collisions, const uint32_t idx_i, const uint32_t idx_j) const override
+    {
+        f_collisions[idx_i] += force(particles, idx_i, idx_j);
+    }
+
+    sf::Vector2f force(const std::vector<Particle>& particles, const uint32_t idx_i, const uint32_t idx_j) const
     {
         float d_ij = distance(particles[idx_j].getPosition(), particles[idx_i].getPosition());
 
-        if (d_ij < 2.f * conf::h)
+        if (d_ij < 2.f * params.h)
         {
             sf::Vector2f u_ij = (particles[idx_j].getPosition() - particles[idx_i].getPosition()) / d_ij;
-            sf::Vector2f f_collision_i = -1.f * conf::k * (2.f * conf::h - d_ij) * u_ij;
-
-            f_collisions[idx_i] += f_collision_i;
-            f_collisions[idx_j] -= f_collision_i;
+            return -1.f * params.k * (2.f * params.h - d_ij) * u_ij;
         }
+        return { 0.f, 0.f };
     }
 };
 
@@ -75,38 +112,57 @@ struct SPH : public Model
 {
     void solve(const std::vector<Particle>& particles, std::vector<sf::Vector2f>& f_collisions, const uint32_t idx_i, const uint32_t idx_j) const override
     {
-        float d_ij = distance(particles[idx_j].getPosition(), particles[idx_i].getPosition());
+        sf::Vector2f f_pressure, f_viscosity;
 
-        if (d_ij < 2.f * conf::h)
+        if (forces(particles, idx_i, idx_j, f_pressure, f_viscosity))
         {
-            /*sf::Clock clockSPH;
-            clockSPH.restart();*/
-            WKernel kernel;
-            float dW_ij = kernel.dW(d_ij);
+            f_collisions[idx_i] += f_pressure + f_viscosity;
+            f_collisions[idx_j] -= f_pressure - f_viscosity;
+        }
+    }
 
+    void solveOnFirst(const std::vector<Particle>& particles, std::vector<sf::Vector2f>& f_collisions, const uint32_t idx_i, const uint32_t idx_j) const override
+    {
+        sf::Vector2f f_pressure, f_viscosity;
+
+        if (forces(particles, idx_i, idx_j, f_pressure, f_viscosity))
+            f_collisions[idx_i] += f_pressure + f_viscosity;
+    }
+
+    bool forces(const std::vector<Particle>& particles, const uint32_t idx_i, const uint32_t idx_j, sf::Vector2f& f_pressure, sf::Vector2f& f_viscosity) const
+    {
+        float d_ij = distance(particles[idx_j].getPosition(), particles[idx_i].getPosition());
+
+        if (d_ij < 2.f * params.h)
+        {
             sf::Vector2f u_ij = (particles[idx_j].getPosition() - particles[idx_i].getPosition()) / d_ij;
 
-            float P_i = particles[idx_i].getPressure();
-            float rho_i = particles[idx_i].getDensity();
-            float P_j = particles[idx_j].getPressure();
-            float rho_j = particles[idx_j].getDensity();
+            pairForces(d_ij, u_ij, particles[idx_i].getPressure(), particles[idx_i].getDensity(), particles[idx_j].getPressure(), particles[idx_j].getDensity(),
+                particles[idx_i].getVelocity() - particles[idx_j].getVelocity(), f_pressure, f_viscosity);
+            return true;
+        }
+        return false;
+    }
 
-            float pressureTerm = P_i / (rho_i * rho_i) + P_j / (rho_j * rho_j);
+    // Pair math on already decoded values, shared with CompactSPH
 
-            sf::Vector2f f_pressure = -1.f * conf::m_particle * conf::m_particle * pressureTerm * dW_ij * u_ij;
+    void pairForces(float d_ij, sf::Vector2f u_ij, float P_i, float rho_i, float P_j, float rho_j, sf::Vector2f v_ij, sf::Vector2f& f_pressure, sf::Vector2f& f_viscosity) const
+    {
+        /*sf::Clock clockSPH;
+        clockSPH.restart();*/
+        WKernel kernel{ params.h };
+        float dW_ij = kernel.dW(d_ij);
 
-            sf::Vector2f v_i = particles[idx_i].getVelocity();
-            sf::Vector2f v_j = particles[idx_j].getVelocity();
-            float dot_product = (v_i - v_j).x * u_ij.x + (v_i - v_j).y * u_ij.y;
-            sf::Vector2f f_viscosity = conf::m_particle * conf::m_particle * conf::alpha_v * conf::h * conf::v_max * (rho_i + rho_j) / 2.f * dot_product * dW_ij * u_ij;
+        float pressureTerm = P_i / (rho_i * rho_i) + P_j / (rho_j * rho_j);
 
-            //std::cout << std::sqrt(f_pressure.x* f_pressure.x+ f_pressure.y * f_pressure.y) << std::endl;
-            //std::cout << pressureTerm << std::endl;
+        f_pressure = -1.f * conf::m_particle * conf::m_particle * pressureTerm * dW_ij * u_ij;
 
-            f_collisions[idx_i] += f_pressure + f_viscosity;
-            f_collisions[idx_j] -= f_pressure - f_viscosity;
-            /*std::cout << clockSPH.restart().asMicroseconds() << std::endl;*/
-        }
+        float dot_product = v_ij.x * u_ij.x + v_ij.y * u_ij.y;
+        f_viscosity = conf::m_particle * conf::m_particle * params.alpha_v * params.h * conf::v_max * (rho_i + rho_j) / 2.f * dot_product * dW_ij * u_ij;
+
+        //std::cout << std::sqrt(f_pressure.x* f_pressure.x+ f_pressure.y * f_pressure.y) << std::endl;
+        //std::cout << pressureTerm << std::endl;
+        /*std::cout << clockSPH.restart().asMicroseconds() << std::endl;*/
     }
 };
 
@@ -131,8 +187,9 @@ struct NaiveDetector : public Detector<Output>
 {
     std::vector<Output> handleInteraction(const std::vector<Particle>& particles, const Action<Output>& action)
     {
+        output_v.assign(particles.size(), Output{});
 
-        for (uint32_t i{ conf::n_particles }; i--; )
+        for (uint32_t i{ (uint32_t)particles.size() }; i--; )
         {
             for (uint32_t j = i; j--; )
             {
@@ -152,25 +209,45 @@ struct GridDetector : public Detector<Output>
 
     public:
 
+        const ActivityTracker* activity = nullptr; // Pairs between two sleeping cells are skipped when set
+        const HashGrid* grid = nullptr; // Prebuilt index of the step, the detector builds its own when unset
+
         std::vector<Output> handleInteraction(const std::vector<Particle>& particles, const Action<Output>& action)
         {
-            hashGrid.clearGrid();
-            hashGrid.mapParticlesToCell(particles);
+            output_v.assign(particles.size(), Output{}); // Emitters and sinks change the count between steps
+
+            if (!grid)
+            {
+                hashGrid.clearGrid();
+                hashGrid.mapParticlesToCell(particles);
+            }
+            const HashGrid& index = grid ? *grid : hashGrid;
 
-            std::vector<uint32_t> hashes = hashGrid.getListOfHash();
+            std::vector<uint32_t> hashes = index.getListOfHash();
 
             for (auto hash : hashes)
             {
-                std::vector<uint32_t> cellIdxs = hashGrid.getContentOfCell(hash);
+                const std::vector<uint32_t>& cellIdxs = index.viewCell(hash);
 
                 sf::Vector2f probeParticlePos = particles[cellIdxs[0]].getPosition();
                 std::vector<uint32_t> neighborsHashes = getNeighborsHash(hash, probeParticlePos);
 
+                bool cellAsleep = activity && activity->isCellAsleep(hash);
+
+                if (cellAsleep)
+                {
+                    neighborsHashes.erase(std::remove_if(neighborsHashes.begin(), neighborsHashes.end(),
+                        [this](uint32_t neighborHash) { return activity->isCellAsleep(neighborHash); }), neighborsHashes.end());
+
+                    if (neighborsHashes.empty())
+                        continue;
+                }
+
                 for (uint32_t i = (uint32_t)cellIdxs.size(); i--; )
                 {
                     // Same cell interactions
 
-                    for (uint32_t j = i; j--; )
+                    for (uint32_t j = cellAsleep ? 0 : i; j--; )
                     {
                         //std::cout << output_v.size() << std::endl;
                         /*for (uint32_t k = output_v.size(), k--, k = 0)
@@ -184,7 +261,7 @@ struct GridDetector : public Detector<Output>
 
                     for (auto neighborHash : neighborsHashes)
                     {
-                        std::vector<uint32_t> neighborCellIdxs = hashGrid.getContentOfCell(neighborHash);
+                        const std::vector<uint32_t>& neighborCellIdxs = index.viewCell(neighborHash);
 
                         for (uint32_t j = (uint32_t)neighborCellIdxs.size(); j--;)
                         {
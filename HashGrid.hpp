@@ -1,5 +1,6 @@
 #pragma once
 #include "configuration.hpp"
+#include <algorithm>
 #include <unordered_map>
 
 struct HashGrid
@@ -11,9 +12,10 @@ struct HashGrid
 		HashGrid();
 		void clearGrid();
 		void mapParticlesToCell(const std::vector<Particle>& particles);
-		std::vector<uint32_t> getContentOfCell(uint32_t hash);
-		uint32_t getHashFromPos(sf::Vector2f pos);
-		std::vector<uint32_t> getListOfHash();
+		std::vector<uint32_t> getContentOfCell(uint32_t hash) const;
+		const std::vector<uint32_t>& viewCell(uint32_t hash) const;
+		static uint32_t getHashFromPos(sf::Vector2f pos);
+		std::vector<uint32_t> getListOfHash() const;
 };
 
 HashGrid::HashGrid()
@@ -23,8 +25,9 @@ HashGrid::HashGrid()
 
 uint32_t HashGrid::getHashFromPos(sf::Vector2f pos)
 {
-	uint32_t x = pos.x / conf::cellSize;
-	uint32_t y = pos.y / conf::cellSize;
+	// Particles that leave the window are kept in the border cells
+	uint32_t x = std::clamp(pos.x / conf::cellSize, 0.f, conf::n_collumns - 1.f);
+	uint32_t y = std::clamp(pos.y / conf::cellSize, 0.f, conf::n_rows - 1.f);
 
 	//uint32_t hash = (uint64_t) std::pow(x * conf::prime_x, y * conf::prime_y) % conf::hashMapSize;
 	//uint32_t hash = (x * conf::prime_x + y * conf::prime_y) % conf::hashMapSize;
@@ -36,7 +39,7 @@ uint32_t HashGrid::getHashFromPos(sf::Vector2f pos)
 
 void HashGrid::mapParticlesToCell(const std::vector<Particle>& particles)
 {
-	for (uint32_t i{ conf::n_particles }; i--; )
+	for (uint32_t i{ (uint32_t)particles.size() }; i--; )
 	{
 		uint32_t hash = getHashFromPos(particles[i].getPosition());
 		
@@ -44,7 +47,7 @@ void HashGrid::mapParticlesToCell(const std::vector<Particle>& particles)
 	}
 }
 
-std::vector<uint32_t> HashGrid::getContentOfCell(uint32_t hash)
+std::vector<uint32_t> HashGrid::getContentOfCell(uint32_t hash) const
 {
 	auto it = hashMap.find(hash);
 
@@ -54,19 +57,39 @@ std::vector<uint32_t> HashGrid::getContentOfCell(uint32_t hash)
 	return {};
 }
 
-std::vector<uint32_t> HashGrid::getListOfHash() {
+// Same as getContentOfCell without the copy
+
+const std::vector<uint32_t>& HashGrid::viewCell(uint32_t hash) const
+{
+	static const std::vector<uint32_t> empty;
+
+	auto it = hashMap.find(hash);
+
+	if (it != hashMap.end())
+		return it->second;
+
+	return empty;
+}
+
+std::vector<uint32_t> HashGrid::getListOfHash() const {
 	
 	std::vector<uint32_t> hashes;
 
 	for (const auto& pair : hashMap)
 	{
-		hashes.push_back(pair.first);
+		if (!pair.second.empty())
+			hashes.push_back(pair.first);
 	}
 
 	return hashes;
 }
 
+// Cells keep their capacity, so rebuilding the grid every step does not allocate once the particle count settles
+
 void HashGrid::clearGrid()
 {
-	hashMap.clear();
+	for (auto& pair : hashMap)
+	{
+		pair.second.clear();
+	}
 }
\ No newline at end of file
@@ -0,0 +1,371 @@
+#pragma once
+#include "configuration.hpp"
+#include "Scene.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <execution>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+
+// Copy of the particle state the diagnostics work on, so the solver can keep stepping
+
+struct ParticleSample
+{
+    sf::Vector2f r;
+    sf::Vector2f v;
+    float rho;
+};
+
+struct Snapshot
+{
+    uint64_t step = 0;
+    float time = 0.f;
+    std::vector<ParticleSample> samples;
+    float rho_0 = conf::rho_0;
+    float sleepingFraction = 0.f;
+    float sleepError = 0.f;
+
+    void capture(const Scene& scene);
+};
+
+struct Observable
+{
+    std::string name;
+    uint32_t cadence; // Steps between samples
+    std::function<float(const Snapshot&)> compute;
+};
+
+// Bounded history of every observable, readable from any thread
+
+struct TimeSeries
+{
+    struct Point
+    {
+        uint64_t step;
+        float time;
+        float value;
+    };
+
+    private:
+        mutable std::mutex mutex;
+        std::vector<std::deque<Point>> series;
+
+    public:
+        void resize(size_t n_observables);
+        void push(uint32_t id, Point point);
+        bool latest(uint32_t id, Point& point) const;
+        std::vector<Point> history(uint32_t id) const;
+};
+
+class ObservablesPipeline
+{
+public:
+    ObservablesPipeline(bool async = true);
+    ~ObservablesPipeline();
+    uint32_t add(const std::string& name, uint32_t cadence, std::function<float(const Snapshot&)> compute);
+    void addDefaults();
+    void submit(const Scene& scene);
+    void flush();
+    const std::vector<Observable>& getObservables() const;
+
+    TimeSeries series;
+
+private:
+    bool isDue(uint64_t step) const;
+    void evaluate(const Snapshot& snapshot, const std::vector<Observable>& list);
+    void workerLoop();
+
+private:
+    std::vector<Observable> observables;
+    std::vector<Observable> evaluating; // Worker's copy, add() may grow observables while it evaluates
+    bool async;
+    Snapshot pending;
+    Snapshot working;
+    bool hasPending = false;
+    bool busy = false;
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable wakeWorker;
+    std::condition_variable idle;
+    std::thread worker;
+};
+
+void Snapshot::capture(const Scene& scene)
+{
+    const std::vector<Particle>& particles = scene.particles;
+
+    step = scene.stepCount;
+    time = scene.time;
+    samples.resize(particles.size());
+    rho_0 = scene.params.rho_0();
+    sleepingFraction = scene.activity.sleepingFraction((uint32_t)particles.size());
+    sleepError = scene.activity.auditError;
+
+    for (uint32_t i{ (uint32_t)particles.size() }; i--; )
+    {
+        samples[i] = { particles[i].getPosition(), particles[i].getVelocity(), particles[i].getDensity() };
+    }
+}
+
+void TimeSeries::resize(size_t n_observables)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    series.resize(n_observables);
+}
+
+void TimeSeries::push(uint32_t id, Point point)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::deque<Point>& points = series[id];
+
+    if (points.size() == conf::observablesHistory)
+        points.pop_front();
+
+    points.push_back(point);
+}
+
+bool TimeSeries::latest(uint32_t id, Point& point) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (id >= series.size() || series[id].empty())
+        return false;
+
+    point = series[id].back();
+    return true;
+}
+
+std::vector<TimeSeries::Point> TimeSeries::history(uint32_t id) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (id >= series.size())
+        return {};
+
+    return { series[id].begin(), series[id].end() };
+}
+
+// Synchronous pipelines evaluate on the caller's thread, for callers that already run in parallel
+
+ObservablesPipeline::ObservablesPipeline(bool async)
+    : async(async)
+{
+    if (async)
+        worker = std::thread(&ObservablesPipeline::workerLoop, this);
+}
+
+ObservablesPipeline::~ObservablesPipeline()
+{
+    if (!async)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wakeWorker.notify_one();
+    worker.join();
+}
+
+uint32_t ObservablesPipeline::add(const std::string& name, uint32_t cadence, std::function<float(const Snapshot&)> compute)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    observables.push_back({ name, std::max(cadence, 1u), std::move(compute) });
+    series.resize(observables.size());
+
+    return (uint32_t)observables.size() - 1;
+}
+
+// The solver only pays for the copy; a snapshot that arrives while the worker is busy replaces the queued one
+
+void ObservablesPipeline::submit(const Scene& scene)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (!isDue(scene.stepCount))
+        return;
+
+    if (!async)
+    {
+        working.capture(scene);
+        evaluate(working, observables);
+        return;
+    }
+
+    pending.capture(scene);
+    hasPending = true;
+
+    lock.unlock();
+    wakeWorker.notify_one();
+}
+
+void ObservablesPipeline::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return !hasPending && !busy; });
+}
+
+const std::vector<Observable>& ObservablesPipeline::getObservables() const
+{
+    return observables;
+}
+
+bool ObservablesPipeline::isDue(uint64_t step) const
+{
+    for (const auto& observable : observables)
+    {
+        if (step % observable.cadence == 0)
+            return true;
+    }
+    return false;
+}
+
+void ObservablesPipeline::evaluate(const Snapshot& snapshot, const std::vector<Observable>& list)
+{
+    for (uint32_t id = 0; id < list.size(); id++)
+    {
+        if (snapshot.step % list[id].cadence != 0)
+            continue;
+
+        series.push(id, { snapshot.step, snapshot.time, list[id].compute(snapshot) });
+    }
+}
+
+void ObservablesPipeline::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+        wakeWorker.wait(lock, [this] { return stop || hasPending; });
+
+        if (stop)
+            return;
+
+        std::swap(pending, working);
+        hasPending = false;
+        busy = true;
+
+        // add() only appends
+        if (evaluating.size() != observables.size())
+            evaluating = observables;
+
+        lock.unlock();
+        evaluate(working, evaluating);
+        lock.lock();
+
+        busy = false;
+        idle.notify_all();
+    }
+}
+
+// Default diagnostics, each one a parallel reduction over the snapshot
+
+namespace diagnostics
+{
+    template <typename Transform>
+    float sum(const Snapshot& snapshot, Transform transform)
+    {
+        return std::transform_reduce(std::execution::par, snapshot.samples.begin(), snapshot.samples.end(), 0.f, std::plus<>(), transform);
+    }
+
+    float kineticEnergy(const Snapshot& snapshot)
+    {
+        return sum(snapshot, [](const ParticleSample& p) { return 0.5f * conf::m_particle * (p.v.x * p.v.x + p.v.y * p.v.y); });
+    }
+
+    float potentialEnergy(const Snapshot& snapshot)
+    {
+        return sum(snapshot, [](const ParticleSample& p) { return conf::m_particle * conf::g * (conf::window_size_f.y - p.r.y); });
+    }
+
+    float totalEnergy(const Snapshot& snapshot)
+    {
+        return sum(snapshot, [](const ParticleSample& p) { return conf::m_particle * (0.5f * (p.v.x * p.v.x + p.v.y * p.v.y) + conf::g * (conf::window_size_f.y - p.r.y)); });
+    }
+
+    float momentumX(const Snapshot& snapshot)
+    {
+        return sum(snapshot, [](const ParticleSample& p) { return conf::m_particle * p.v.x; });
+    }
+
+    float momentumY(const Snapshot& snapshot)
+    {
+        return sum(snapshot, [](const ParticleSample& p) { return conf::m_particle * p.v.y; });
+    }
+
+    float maxVelocity(const Snapshot& snapshot)
+    {
+        return std::transform_reduce(std::execution::par, snapshot.samples.begin(), snapshot.samples.end(), 0.f,
+            [](float a, float b) { return std::max(a, b); },
+            [](const ParticleSample& p) { return std::sqrt(p.v.x * p.v.x + p.v.y * p.v.y); });
+    }
+
+    // Mean relative deviation from rho_0
+
+    float densityError(const Snapshot& snapshot)
+    {
+        if (snapshot.samples.empty())
+            return 0.f;
+
+        return sum(snapshot, [&snapshot](const ParticleSample& p) { return std::abs(p.rho - snapshot.rho_0) / snapshot.rho_0; }) / snapshot.samples.size();
+    }
+
+    // Height of the highest particle that belongs to the bulk, so isolated splashes are ignored.
+    // The bulk is measured against the median density, rho_0 is not reached by a loose lattice.
+
+    float freeSurfaceHeight(const Snapshot& snapshot)
+    {
+        if (snapshot.samples.empty())
+            return 0.f;
+
+        std::vector<float> densities(snapshot.samples.size());
+        std::transform(snapshot.samples.begin(), snapshot.samples.end(), densities.begin(), [](const ParticleSample& p) { return p.rho; });
+        std::nth_element(densities.begin(), densities.begin() + densities.size() / 2, densities.end());
+        float bulk = conf::surfaceDensityRatio * densities[densities.size() / 2];
+
+        float top = std::transform_reduce(std::execution::par, snapshot.samples.begin(), snapshot.samples.end(), conf::window_size_f.y,
+            [](float a, float b) { return std::min(a, b); },
+            [bulk](const ParticleSample& p) { return p.rho >= bulk ? p.r.y : conf::window_size_f.y; });
+
+        return conf::window_size_f.y - top;
+    }
+
+    float sleepingFraction(const Snapshot& snapshot)
+    {
+        return snapshot.sleepingFraction;
+    }
+
+    float sleepError(const Snapshot& snapshot)
+    {
+        return snapshot.sleepError;
+    }
+
+    // Changes with emitters and sinks, which also make the energies non conserved
+
+    float particleCount(const Snapshot& snapshot)
+    {
+        return (float)snapshot.samples.size();
+    }
+}
+
+void ObservablesPipeline::addDefaults()
+{
+    add("Kinetic Energy", conf::observablesCadence, diagnostics::kineticEnergy);
+    add("Potential Energy", conf::observablesCadence, diagnostics::potentialEnergy);
+    add("Total Energy", conf::observablesCadence, diagnostics::totalEnergy);
+    add("Momentum x", conf::observablesCadence, diagnostics::momentumX);
+    add("Momentum y", conf::observablesCadence, diagnostics::momentumY);
+    add("Max Velocity", conf::observablesCadence, diagnostics::maxVelocity);
+    add("Density Error", conf::observablesCadence, diagnostics::densityError);
+    add("Free Surface Height", conf::observablesCadence, diagnostics::freeSurfaceHeight);
+    add("Sleeping Fraction", conf::observablesCadence, diagnostics::sleepingFraction);
+    add("Sleep Density Error", conf::observablesCadence, diagnostics::sleepError);
+    add("Particle Count", conf::observablesCadence, diagnostics::particleCount);
+}
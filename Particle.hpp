@@ -1,5 +1,6 @@
 #pragma once
 #include "configuration.hpp"
+#include <algorithm>
 #include <random>
 
 struct Particle
@@ -13,20 +14,21 @@ struct Particle
 		float P = 1;
 
 	private:
-		void handleWallCollisions(sf::Time deltaTime);
-	
-	public:
-		sf::CircleShape shape;
+		void handleWallCollisions(sf::Time deltaTime, const PhysicsParams& params);
 
 	public:
 		Particle();
 		Particle(sf::Vector2f pos);
 		Particle(sf::Vector2f pos, sf::Vector2f vel);
 		Particle& operator=(const Particle& other);
-		void updateParticle(sf::Time deltaTime, sf::Vector2f& f_interaction, sf::Vector2f& f_external);
-		void setDensityAndPressure(float new_rho);
+		void updateParticle(sf::Time deltaTime, const sf::Vector2f& f_interaction, const sf::Vector2f& f_external, const PhysicsParams& params);
+		void updateParticleSemiImplicit(sf::Time deltaTime, const sf::Vector2f& f_total, const PhysicsParams& params);
+		void setDensityAndPressure(float new_rho, const PhysicsParams& params);
+		void assignDensityAndPressure(float new_rho, float new_P);
+		static float densityFromSum(float neighborDensity, const PhysicsParams& params);
 		sf::Vector2f getPosition() const;
 		sf::Vector2f getVelocity() const;
+		sf::Vector2f getAcceleration() const;
 		float getVelocityMagnitude() const;
 		float getDensity() const;
 		float getPressure() const;
@@ -34,39 +36,31 @@ struct Particle
 
 Particle::Particle()
 {
-	shape.setRadius(conf::h);
-	shape.setOrigin(conf::h, conf::h);
-	shape.setPosition(r);
-	shape.setFillColor(sf::Color::Blue);
 }
 Particle::Particle(sf::Vector2f pos)
 	: r(pos)
 {
-	shape.setRadius(conf::h);
-	shape.setOrigin(conf::h, conf::h);
-	shape.setPosition(r);
-	shape.setFillColor(sf::Color::Blue); // Check why the following doesn't work
-	//shape.setFillColor(conf::particle_color); 
 }
 Particle::Particle(sf::Vector2f pos, sf::Vector2f vel)
         : r(pos), v(vel)
 {
-	shape.setRadius(conf::h);
-	shape.setOrigin(conf::h , conf::h);
-	shape.setPosition(r);
-	shape.setFillColor(sf::Color::Blue); // Check why the following doesn't work
-	//shape.setFillColor(conf::particle_color); 
 }
 
+// m is const so the implicit assignment is deleted. Compaction moves particles between slots, so the whole state is copied
+
 Particle& Particle::operator=(const Particle& other)
 {
 	if (this != &other) {
 		r = other.r;
+		v = other.v;
+		a = other.a;
+		rho = other.rho;
+		P = other.P;
 	}
 	return *this;
 }
 
-void Particle::updateParticle(sf::Time deltaTime, sf::Vector2f& f_interaction, sf::Vector2f& f_external)
+void Particle::updateParticle(sf::Time deltaTime, const sf::Vector2f& f_interaction, const sf::Vector2f& f_external, const PhysicsParams& params)
 {
 	a = 1.f / m * (f_interaction + f_external);
 
@@ -74,22 +68,45 @@ void Particle::updateParticle(sf::Time deltaTime, sf::Vector2f& f_interaction, s
 	r += v * deltaTime.asSeconds();
 	v += a * deltaTime.asSeconds();
 
-	handleWallCollisions(deltaTime);
+	handleWallCollisions(deltaTime, params);
+}
+
+void Particle::updateParticleSemiImplicit(sf::Time deltaTime, const sf::Vector2f& f_total, const PhysicsParams& params)
+{
+	a = 1.f / m * f_total;
+
+	// Semi-implicit Euler Method, the position moves with the new velocity
+	v += a * deltaTime.asSeconds();
+	r += v * deltaTime.asSeconds();
+
+	handleWallCollisions(deltaTime, params);
+
+	// The incompressible solver rests the whole column on the walls, so they also stop the position.
+	// Reflected instead of clamped, clamping stacked the particles of a corner on the same point
+	if (r.x < params.h)
+		r.x = 2.f * params.h - r.x;
+	else if (r.x > conf::window_size_f.x - params.h)
+		r.x = 2.f * (conf::window_size_f.x - params.h) - r.x;
+
+	if (r.y < params.h)
+		r.y = 2.f * params.h - r.y;
+	else if (r.y > conf::window_size_f.y - params.h)
+		r.y = 2.f * (conf::window_size_f.y - params.h) - r.y;
 }
 
 // Inellastic discrete
 
-void Particle::handleWallCollisions(sf::Time deltaTime)
+void Particle::handleWallCollisions(sf::Time deltaTime, const PhysicsParams& params)
 {
-	if (r.x < conf::h && v.x < 0 || r.x > conf::window_size_f.x - conf::h && v.x > 0)
+	if (r.x < params.h && v.x < 0 || r.x > conf::window_size_f.x - params.h && v.x > 0)
 	{
-		v.x *= -1.f * conf::alpha;
-		v.y *= conf::alpha;
+		v.x *= -1.f * params.alpha;
+		v.y *= params.alpha;
 	}
-	if (r.y < conf::h && v.y < 0 || r.y > conf::window_size_f.y - conf::h && v.y > 0)
+	if (r.y < params.h && v.y < 0 || r.y > conf::window_size_f.y - params.h && v.y > 0)
 	{
-		v.y *= -1.f * conf::alpha;
-		v.x *= conf::alpha;
+		v.y *= -1.f * params.alpha;
+		v.x *= params.alpha;
 	}
 }
 
@@ -118,13 +135,12 @@ void Particle::handleWallCollisions(sf::Time deltaTime)
 //	}
 //	return particles;
 //}
-std::vector<Particle> createParticles(uint32_t count)
+std::vector<Particle> createParticles(uint32_t count, uint32_t seed = std::random_device{}())
 {
 	std::vector<Particle> particles;
 	particles.reserve(count);
 
-	std::random_device rd;
-	std::mt19937 gen(rd());
+	std::mt19937 gen(seed);
 	std::uniform_real_distribution<float> dis(0.0f, 1.0f);
 
 	float spacing = 3 * conf::h;
@@ -170,6 +186,11 @@ sf::Vector2f Particle::getVelocity() const
 	return v;
 }
 
+sf::Vector2f Particle::getAcceleration() const
+{
+	return a;
+}
+
 float Particle::getVelocityMagnitude() const
 {
 	return std::sqrt(v.x * v.x + v.y * v.y);
@@ -185,10 +206,25 @@ float Particle::getPressure() const
 	return P;
 }
 
-void Particle::setDensityAndPressure(float new_rho)
+float Particle::densityFromSum(float neighborDensity, const PhysicsParams& params)
 {
-	float S = 14.f / 30.f * 3.14159 * conf::h * conf::h;
+	float S = 14.f / 30.f * 3.14159 * params.h * params.h;
 
-	rho = new_rho + 2.f/( S * 3.f); // Le agrego la autodensidad
-	P = conf::rho_0 * conf::v_max * conf::v_max / conf::gamma * (std::pow(rho / conf::rho_0, conf::gamma) - 1);
+	return neighborDensity + 2.f / (S * 3.f); // Le agrego la autodensidad
+}
+
+void Particle::setDensityAndPressure(float new_rho, const PhysicsParams& params)
+{
+	float rho_0 = params.rho_0();
+
+	rho = densityFromSum(new_rho, params);
+	P = rho_0 * conf::v_max * conf::v_max / params.gamma * (std::pow(rho / rho_0, params.gamma) - 1);
+}
+
+// For solvers that compute the pressure themselves instead of using the equation of state
+
+void Particle::assignDensityAndPressure(float new_rho, float new_P)
+{
+	rho = new_rho;
+	P = new_P;
 }
\ No newline at end of file
@@ -0,0 +1,191 @@
+#pragma once
+#include "configuration.hpp"
+#include "Particle.hpp"
+#include "ActivityTracker.hpp"
+#include "SpatialQuery.hpp"
+#include <algorithm>
+
+// Open boundaries. Emitters spawn particles along a segment wherever the fluid has left room
+// and sinks delete every particle inside their box. Deleted slots go to a free list that the
+// emitters refill first, and the holes left are compacted in one batch, so the particle array
+// stays dense. Applied at the start of the step, before the grid is built, so indices stay
+// valid until the next one. The free space is probed on the grid of the last step.
+
+struct Emitter
+{
+    sf::Vector2f start; // Segment the particles are spawned along
+    sf::Vector2f end;
+    sf::Vector2f velocity; // Initial velocity, should point away from the segment
+    bool enabled = true;
+};
+
+struct Sink
+{
+    QueryBox region;
+    bool enabled = true;
+};
+
+class ParticleFlow
+{
+public:
+    ParticleFlow();
+    void apply(std::vector<Particle>& particles, ActivityTracker& activity, const SpatialQuery& query);
+
+    std::vector<Emitter> emitters;
+    std::vector<Sink> sinks;
+    uint64_t spawned = 0;
+    uint64_t removed = 0;
+
+private:
+    void drain(const std::vector<Particle>& particles, ActivityTracker& activity);
+    void emit(std::vector<Particle>& particles, ActivityTracker& activity, const SpatialQuery& query);
+    bool isFree(uint32_t point) const;
+    void spawn(std::vector<Particle>& particles, ActivityTracker& activity, const Particle& particle);
+    void compact(std::vector<Particle>& particles, ActivityTracker& activity);
+
+private:
+    std::vector<uint32_t> freeList;
+    std::vector<uint8_t> removedFlag; // Per particle, set while its slot is in the free list
+    std::vector<sf::Vector2f> spawnPoints;
+    std::vector<sf::Vector2f> spawnVelocities;
+    std::vector<uint32_t> probeResults;
+    std::vector<uint32_t> probeCounts;
+};
+
+ParticleFlow::ParticleFlow()
+{
+    freeList.reserve(conf::max_particles);
+    removedFlag.reserve(conf::max_particles);
+}
+
+void ParticleFlow::apply(std::vector<Particle>& particles, ActivityTracker& activity, const SpatialQuery& query)
+{
+    if (emitters.empty() && sinks.empty())
+        return;
+
+    removedFlag.assign(particles.size(), 0);
+
+    drain(particles, activity);
+    emit(particles, activity, query);
+    compact(particles, activity);
+}
+
+void ParticleFlow::drain(const std::vector<Particle>& particles, ActivityTracker& activity)
+{
+    for (uint32_t i = 0; i < particles.size(); i++)
+    {
+        sf::Vector2f pos = particles[i].getPosition();
+
+        for (const Sink& sink : sinks)
+        {
+            if (!sink.enabled || pos.x < sink.region.min.x || pos.y < sink.region.min.y || pos.x >= sink.region.max.x || pos.y >= sink.region.max.y)
+                continue;
+
+            removedFlag[i] = 1;
+            freeList.push_back(i);
+            activity.wakeAround(pos);
+            removed++;
+            break;
+        }
+    }
+}
+
+// Every emitterSpacing along the segment a particle is spawned once no other one is closer than
+// emitterSpacing, so the rows follow the speed the fluid actually moves away at, not the nominal one
+
+void ParticleFlow::emit(std::vector<Particle>& particles, ActivityTracker& activity, const SpatialQuery& query)
+{
+    spawnPoints.clear();
+    spawnVelocities.clear();
+
+    for (const Emitter& emitter : emitters)
+    {
+        if (!emitter.enabled)
+            continue;
+
+        float length = distance(emitter.start, emitter.end);
+        uint32_t count = (uint32_t)(length / conf::emitterSpacing) + 1;
+
+        for (uint32_t k = 0; k < count; k++)
+        {
+            float t = count > 1 ? (float)k / (count - 1) : 0.5f;
+            spawnPoints.push_back(emitter.start + t * (emitter.end - emitter.start));
+            spawnVelocities.push_back(emitter.velocity);
+        }
+    }
+
+    if (spawnPoints.empty())
+        return;
+
+    query.radius(spawnPoints, conf::emitterSpacing, conf::emitterProbeResults, probeResults, probeCounts);
+
+    for (uint32_t point = 0; point < spawnPoints.size(); point++)
+    {
+        if (isFree(point))
+            spawn(particles, activity, Particle(spawnPoints[point], spawnVelocities[point]));
+    }
+}
+
+// Particles a sink has just removed do not count. When more than emitterProbeResults are near, some are surely still there
+
+bool ParticleFlow::isFree(uint32_t point) const
+{
+    if (probeCounts[point] > conf::emitterProbeResults)
+        return false;
+
+    for (uint32_t n = 0; n < probeCounts[point]; n++)
+    {
+        if (!removedFlag[probeResults[point * conf::emitterProbeResults + n]])
+            return false;
+    }
+    return true;
+}
+
+void ParticleFlow::spawn(std::vector<Particle>& particles, ActivityTracker& activity, const Particle& particle)
+{
+    if (!freeList.empty())
+    {
+        uint32_t slot = freeList.back();
+        freeList.pop_back();
+        removedFlag[slot] = 0;
+        particles[slot] = particle;
+    }
+    else if (particles.size() < conf::max_particles)
+    {
+        particles.push_back(particle);
+        removedFlag.push_back(0);
+    }
+    else
+    {
+        return;
+    }
+    activity.wakeAround(particle.getPosition());
+    spawned++;
+}
+
+// Holes the emitters did not reuse are filled with the particles at the end of the array
+
+void ParticleFlow::compact(std::vector<Particle>& particles, ActivityTracker& activity)
+{
+    std::sort(freeList.begin(), freeList.end());
+
+    for (uint32_t front = 0; front < freeList.size(); )
+    {
+        uint32_t last = (uint32_t)particles.size() - 1;
+
+        // The last slot is the largest hole left
+        if (removedFlag[last])
+        {
+            freeList.pop_back();
+        }
+        else
+        {
+            uint32_t hole = freeList[front++];
+            particles[hole] = particles[last];
+            activity.moveParticle(last, hole);
+        }
+        particles.pop_back();
+        removedFlag.pop_back();
+    }
+    freeList.clear();
+}
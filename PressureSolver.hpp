@@ -0,0 +1,336 @@
+#pragma once
+#include "configuration.hpp"
+#include "Particle.hpp"
+#include "hashGrid.hpp"
+#include "GlobalInteraction.hpp"
+#include "ActivityTracker.hpp"
+#include "WKernel.hpp"
+#include <algorithm>
+#include <execution>
+#include <numeric>
+
+// Predictive-corrective incompressible SPH (PCISPH). Instead of a stiff equation of state,
+// pressures are corrected iteratively until the predicted density error drops below
+// pcisphTolerance, which lets the step be up to pcisphTauFactor times longer than the WCSPH one.
+// The step is also limited by pcisphCourant, at the rest density the fluid falls apart beyond it.
+
+class PCISPHSolver
+{
+public:
+    void step(std::vector<Particle>& particles, const HashGrid& grid, const PhysicsParams& params, const ActivityTracker& activity, float maxDisplacement, sf::Time deltaTime);
+    static float timestep(const PhysicsParams& params, float maxSpeed);
+    static float prototypeSpacing(const PhysicsParams& params);
+
+    uint32_t lastIterations = 0;
+    float lastDensityError = 0.f; // Max relative density error of the last step
+
+private:
+    template <typename Function>
+    void parallelFor(uint32_t n, Function function);
+    void findNeighbors(const std::vector<Particle>& particles, const HashGrid& grid, const PhysicsParams& params, const ActivityTracker& activity, float maxDisplacement);
+    static void sumPrototypeGradients(const PhysicsParams& params, sf::Vector2f& sumGrad, float& sumGradSquared);
+    static float computeDelta(const PhysicsParams& params, float dt);
+
+private:
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> neighbors; // pcisphMaxNeighbors slots per particle
+    std::vector<uint32_t> n_neighbors;
+    std::vector<uint8_t> asleep;
+    std::vector<sf::Vector2f> r_pred;
+    std::vector<sf::Vector2f> f_nonPressure;
+    std::vector<sf::Vector2f> f_pressure;
+    std::vector<float> rho_pred;
+    std::vector<float> pressure;
+    std::vector<float> errors;
+};
+
+template <typename Function>
+void PCISPHSolver::parallelFor(uint32_t n, Function function)
+{
+    if (indices.size() != n)
+    {
+        indices.resize(n);
+        std::iota(indices.begin(), indices.end(), 0);
+    }
+    std::for_each(std::execution::par, indices.begin(), indices.end(), function);
+}
+
+// Neighbor lists are built once per step and reused by every iteration, with a margin for the predicted
+// motion. Two particles approach at most twice the largest displacement of the last step. The search
+// only covers the adjacent cells, so the cutoff stops at a cell. Sleeping particles get no list, they are
+// only read as neighbors.
+
+void PCISPHSolver::findNeighbors(const std::vector<Particle>& particles, const HashGrid& grid, const PhysicsParams& params, const ActivityTracker& activity, float maxDisplacement)
+{
+    float cutoff = std::min(2.f * params.h + std::max(2.f * maxDisplacement, conf::querySlack), (float)conf::cellSize);
+
+    parallelFor((uint32_t)particles.size(), [&](uint32_t i)
+    {
+        asleep[i] = activity.isAsleep(particles[i]);
+
+        if (asleep[i])
+        {
+            n_neighbors[i] = 0;
+            return;
+        }
+
+        sf::Vector2f pos = particles[i].getPosition();
+        uint32_t x = HashGrid::getHashFromPos(pos) % conf::n_collumns;
+        uint32_t y = HashGrid::getHashFromPos(pos) / conf::n_collumns;
+        uint32_t count = 0;
+
+        for (uint32_t ny = (y > 0 ? y - 1 : 0); ny <= std::min(y + 1, conf::n_rows - 1); ny++)
+        {
+            for (uint32_t nx = (x > 0 ? x - 1 : 0); nx <= std::min(x + 1, conf::n_collumns - 1); nx++)
+            {
+                for (uint32_t j : grid.viewCell(nx + conf::n_collumns * ny))
+                {
+                    if (j == i || count == conf::pcisphMaxNeighbors || distance(particles[j].getPosition(), pos) > cutoff)
+                        continue;
+
+                    neighbors[i * conf::pcisphMaxNeighbors + count++] = j;
+                }
+            }
+        }
+        n_neighbors[i] = count;
+    });
+}
+
+// The prototype is a particle with a full neighborhood on a square lattice. Its spacing is the one
+// at which the density, summed like the WCSPH model does, is rho_0, so both solvers rest at the same
+// density. The density falls with the spacing, so it is found by bisection between h and 2h.
+
+float PCISPHSolver::prototypeSpacing(const PhysicsParams& params)
+{
+    WKernel kernel{ params.h };
+    float rho_0 = params.rho_0();
+    float low = params.h;
+    float high = 2.f * params.h;
+
+    for (uint32_t iteration = 0; iteration < 32; iteration++)
+    {
+        float spacing = 0.5f * (low + high);
+        int32_t reach = (int32_t)std::ceil(2.f * params.h / spacing);
+        float rho = 0.f;
+
+        for (int32_t y = -reach; y <= reach; y++)
+        {
+            for (int32_t x = -reach; x <= reach; x++)
+            {
+                if (x != 0 || y != 0)
+                    rho += conf::m_particle * kernel.W(spacing * std::sqrt((float)(x * x + y * y)));
+            }
+        }
+
+        if (Particle::densityFromSum(rho, params) > rho_0)
+            low = spacing;
+        else
+            high = spacing;
+    }
+    return 0.5f * (low + high);
+}
+
+void PCISPHSolver::sumPrototypeGradients(const PhysicsParams& params, sf::Vector2f& sumGrad, float& sumGradSquared)
+{
+    WKernel kernel{ params.h };
+    float spacing = prototypeSpacing(params);
+    int32_t reach = (int32_t)std::ceil(2.f * params.h / spacing);
+
+    sumGrad = { 0.f, 0.f };
+    sumGradSquared = 0.f;
+
+    for (int32_t y = -reach; y <= reach; y++)
+    {
+        for (int32_t x = -reach; x <= reach; x++)
+        {
+            sf::Vector2f r_ij = { x * spacing, y * spacing };
+            float d = std::sqrt(r_ij.x * r_ij.x + r_ij.y * r_ij.y);
+
+            if (d == 0.f || d >= 2.f * params.h)
+                continue;
+
+            sf::Vector2f grad = kernel.dW(d) / d * r_ij;
+            sumGrad += grad;
+            sumGradSquared += grad.x * grad.x + grad.y * grad.y;
+        }
+    }
+}
+
+// Scaling between density error and pressure correction
+
+float PCISPHSolver::computeDelta(const PhysicsParams& params, float dt)
+{
+    sf::Vector2f sumGrad;
+    float sumGradSquared;
+    sumPrototypeGradients(params, sumGrad, sumGradSquared);
+
+    float rho_0 = params.rho_0();
+    float beta = 2.f * (dt * conf::m_particle / rho_0) * (dt * conf::m_particle / rho_0);
+    return 1.f / (beta * (sumGrad.x * sumGrad.x + sumGrad.y * sumGrad.y + sumGradSquared));
+}
+
+float PCISPHSolver::timestep(const PhysicsParams& params, float maxSpeed)
+{
+    if (maxSpeed * params.tau() <= conf::pcisphCourant * params.h)
+        return params.tau();
+
+    return conf::pcisphCourant * params.h / maxSpeed;
+}
+
+void PCISPHSolver::step(std::vector<Particle>& particles, const HashGrid& grid, const PhysicsParams& params, const ActivityTracker& activity, float maxDisplacement, sf::Time deltaTime)
+{
+    uint32_t n = (uint32_t)particles.size();
+    float dt = deltaTime.asSeconds();
+    float rho_0 = params.rho_0();
+    float m = conf::m_particle;
+    float delta = computeDelta(params, dt);
+
+    WKernel kernel{ params.h };
+
+    neighbors.resize(n * conf::pcisphMaxNeighbors);
+    n_neighbors.resize(n);
+    asleep.resize(n);
+    r_pred.resize(n);
+    f_nonPressure.resize(n);
+    f_pressure.assign(n, { 0.f, 0.f });
+    rho_pred.resize(n);
+    pressure.assign(n, 0.f);
+    errors.resize(n);
+
+    findNeighbors(particles, grid, params, activity, maxDisplacement);
+
+    // Densities at the current positions, needed by the viscosity term. Sleeping particles keep
+    // the density and pressure they had when they fell asleep
+
+    parallelFor(n, [&](uint32_t i)
+    {
+        if (asleep[i])
+        {
+            rho_pred[i] = particles[i].getDensity();
+            pressure[i] = particles[i].getPressure();
+            return;
+        }
+
+        float rho = 0.f;
+
+        for (uint32_t k = 0; k < n_neighbors[i]; k++)
+        {
+            rho += m * kernel.W(distance(particles[i].getPosition(), particles[neighbors[i * conf::pcisphMaxNeighbors + k]].getPosition()));
+        }
+        particles[i].assignDensityAndPressure(Particle::densityFromSum(rho, params), 0.f);
+    });
+
+    // Viscosity, drag and gravity stay explicit, reusing the WCSPH viscosity term. At the longer
+    // step that term alone is unstable, so it is scaled down to at most cancel the relative
+    // velocity within one step.
+
+    SPH model;
+    model.params = params;
+
+    parallelFor(n, [&](uint32_t i)
+    {
+        sf::Vector2f f_viscosity_sum{ 0.f, 0.f };
+        sf::Vector2f f_p, f_v;
+        float dampingRate = 0.f;
+
+        for (uint32_t k = 0; k < n_neighbors[i]; k++)
+        {
+            uint32_t j = neighbors[i * conf::pcisphMaxNeighbors + k];
+            float d_ij = distance(particles[i].getPosition(), particles[j].getPosition());
+
+            // The pair direction is undefined, as in the pressure loop
+            if (d_ij == 0.f || !model.forces(particles, i, j, f_p, f_v))
+                continue;
+            float rho_ij = (particles[i].getDensity() + particles[j].getDensity()) / 2.f;
+
+            f_viscosity_sum += f_v;
+            dampingRate += m * params.alpha_v * params.h * conf::v_max * rho_ij * std::abs(kernel.dW(d_ij));
+        }
+
+        if (dampingRate * dt > 1.f)
+            f_viscosity_sum = 1.f / (dampingRate * dt) * f_viscosity_sum;
+
+        f_nonPressure[i] = f_viscosity_sum - params.beta * particles[i].getVelocity() + sf::Vector2f{ 0.f, m * conf::g };
+    });
+
+    for (lastIterations = 0; lastIterations < conf::pcisphMaxIterations; lastIterations++)
+    {
+        // Predict positions with the semi-implicit update used to integrate
+
+        parallelFor(n, [&](uint32_t i)
+        {
+            if (asleep[i])
+            {
+                r_pred[i] = particles[i].getPosition();
+                return;
+            }
+            sf::Vector2f v_pred = particles[i].getVelocity() + dt / m * (f_nonPressure[i] + f_pressure[i]);
+            r_pred[i] = particles[i].getPosition() + dt * v_pred;
+        });
+
+        // Correct pressures from the predicted density error. Only compression is corrected so the free surface does not clump
+
+        parallelFor(n, [&](uint32_t i)
+        {
+            if (asleep[i])
+            {
+                errors[i] = 0.f;
+                return;
+            }
+
+            float rho = 0.f;
+
+            for (uint32_t k = 0; k < n_neighbors[i]; k++)
+            {
+                uint32_t j = neighbors[i * conf::pcisphMaxNeighbors + k];
+                rho += m * kernel.W(distance(r_pred[i], r_pred[j]));
+            }
+
+            rho = Particle::densityFromSum(rho, params);
+            rho_pred[i] = rho;
+            float error = std::max(rho - rho_0, 0.f);
+            pressure[i] = std::max(pressure[i] + delta * error, 0.f);
+            errors[i] = error / rho_0;
+        });
+
+        lastDensityError = std::reduce(std::execution::par, errors.begin(), errors.end(), 0.f, [](float a, float b) { return std::max(a, b); });
+
+        parallelFor(n, [&](uint32_t i)
+        {
+            if (asleep[i])
+                return;
+
+            sf::Vector2f force{ 0.f, 0.f };
+            sf::Vector2f r_i = particles[i].getPosition();
+
+            for (uint32_t k = 0; k < n_neighbors[i]; k++)
+            {
+                uint32_t j = neighbors[i * conf::pcisphMaxNeighbors + k];
+                sf::Vector2f r_ij = r_i - particles[j].getPosition();
+                float d = distance(r_i, particles[j].getPosition());
+
+                if (d == 0.f)
+                    continue;
+
+                sf::Vector2f gradW = kernel.dW(d) / d * r_ij;
+                force -= m * m * (pressure[i] + pressure[j]) / (rho_0 * rho_0) * gradW;
+            }
+            f_pressure[i] = force;
+        });
+
+        if (lastIterations + 1 >= conf::pcisphMinIterations && lastDensityError < conf::pcisphTolerance)
+        {
+            lastIterations++;
+            break;
+        }
+    }
+
+    parallelFor(n, [&](uint32_t i)
+    {
+        if (asleep[i])
+            return;
+
+        particles[i].assignDensityAndPressure(rho_pred[i], pressure[i]);
+        particles[i].updateParticleSemiImplicit(deltaTime, f_nonPressure[i] + f_pressure[i], params);
+    });
+}
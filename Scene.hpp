@@ -0,0 +1,191 @@
+#pragma once
+#include "configuration.hpp"
+#include "Particle.hpp"
+#include "hashGrid.hpp"
+#include "GlobalInteraction.hpp"
+#include "ActivityTracker.hpp"
+#include "StepScheduler.hpp"
+#include "SpatialQuery.hpp"
+#include "PressureSolver.hpp"
+#include "ParticleFlow.hpp"
+#include "CompactState.hpp"
+#include <execution>
+#include <memory>
+#include <numeric>
+
+// Particle state and stepping of one simulation, without any window.
+// WCSPH steps run as a block task graph when there is a pool, otherwise serially.
+
+class Scene
+{
+public:
+    Scene(const PhysicsParams& params = PhysicsParams{}, uint32_t seed = std::random_device{}(), ThreadPool* pool = nullptr);
+    void step();
+    SpatialQuery query() const;
+
+private:
+    void stepSerial(sf::Time deltaTime);
+    float maxSpeed() const;
+    template <typename DensityAction, typename ForceAction>
+    void solveSerial(sf::Time deltaTime, const DensityAction& densityAction, const ForceAction& forceAction);
+
+public:
+    PhysicsParams params;
+    std::vector<Particle> particles;
+    ActivityTracker activity;
+    HashGrid grid; // Built once per step, shared by the solver passes and the queries
+    std::unique_ptr<StepScheduler> scheduler;
+    PCISPHSolver pcisph;
+    ParticleFlow flow; // Emitters and sinks, empty for a closed box
+    CompactState compact; // Packed copy the pair kernels read when params.compactState is set
+
+    uint64_t stepCount = 0;
+    float time = 0.f;
+    float maxDisplacement = 0.f; // Largest distance a particle moved in the last step, how far the grid is out of date
+};
+
+Scene::Scene(const PhysicsParams& params, uint32_t seed, ThreadPool* pool)
+    : params(params), particles(createParticles(conf::n_particles, seed))
+{
+    particles.reserve(conf::max_particles);
+
+    // The emitters look for free space on the grid of the last step, the first one included
+    grid.mapParticlesToCell(particles);
+
+    if (pool)
+        scheduler = std::make_unique<StepScheduler>(*pool);
+}
+
+void Scene::step()
+{
+    flow.apply(particles, activity, query());
+
+    grid.clearGrid();
+    grid.mapParticlesToCell(particles);
+    float speedBefore = maxSpeed();
+
+    sf::Time deltaTime = sf::seconds(params.solver == Solver::PCISPH ? PCISPHSolver::timestep(params, speedBefore) : params.tau());
+
+    // Compare the frozen densities against a full solve from time to time
+
+    if (activity.anyAsleep() && (stepCount + 1) % conf::sleepAuditInterval == 0)
+    {
+        GlobalInteraction<GridDetector<float>, DensityCalculator, float> fullDensityCalculator;
+        fullDensityCalculator.action.params = params;
+        fullDensityCalculator.detector.grid = &grid;
+        activity.audit(particles, fullDensityCalculator.handleInteraction(particles), params);
+    }
+
+    if (params.solver == Solver::PCISPH)
+    {
+        pcisph.step(particles, grid, params, activity, maxDisplacement, deltaTime);
+    }
+    else if (scheduler)
+    {
+        scheduler->step(particles, grid, params, activity, compact);
+    }
+    else
+    {
+        stepSerial(deltaTime);
+    }
+
+    activity.update(particles);
+
+    // Explicit Euler moves with the old velocity and semi-implicit with the new one
+    maxDisplacement = std::max(speedBefore, maxSpeed()) * deltaTime.asSeconds();
+
+    stepCount++;
+    time += deltaTime.asSeconds();
+}
+
+void Scene::stepSerial(sf::Time deltaTime)
+{
+    if (params.compactState)
+    {
+        CompactDensityCalculator densityAction;
+        densityAction.params = params;
+        densityAction.state = &compact;
+
+        CompactSPH forceAction;
+        forceAction.params = params;
+        forceAction.state = &compact;
+
+        compact.pack(particles);
+        solveSerial(deltaTime, densityAction, forceAction);
+    }
+    else
+    {
+        DensityCalculator densityAction;
+        densityAction.params = params;
+
+        SPH forceAction;
+        forceAction.params = params;
+
+        solveSerial(deltaTime, densityAction, forceAction);
+    }
+}
+
+template <typename DensityAction, typename ForceAction>
+void Scene::solveSerial(sf::Time deltaTime, const DensityAction& densityAction, const ForceAction& forceAction)
+{
+    // Change CollisionHandler here
+
+    GlobalInteraction<GridDetector<float>, DensityAction, float> densityCalculator;
+    densityCalculator.action = densityAction;
+    densityCalculator.detector.activity = &activity;
+    densityCalculator.detector.grid = &grid;
+
+    std::vector<float> densities = densityCalculator.handleInteraction(particles);
+
+    for (uint32_t i{ (uint32_t)particles.size() }; i--; )
+    {
+        if (!activity.isAsleep(particles[i]))
+            particles[i].setDensityAndPressure(densities[i], params);
+
+        if (params.compactState)
+            compact.packDensityAndPressure(i, particles[i]);
+    }
+
+    GlobalInteraction<GridDetector<sf::Vector2f>, ForceAction, sf::Vector2f> collisionHandler;
+    collisionHandler.action = forceAction;
+    collisionHandler.detector.activity = &activity;
+    collisionHandler.detector.grid = &grid;
+
+    /*sf::Clock clockSPH;
+    clockSPH.restart();*/
+
+    std::vector<sf::Vector2f> f_collisions = collisionHandler.handleInteraction(particles);
+
+    //std::cout << clockSPH.restart().asMicroseconds() << std::endl;
+
+    sf::Vector2f f_grav = { 0.f, conf::m_particle * conf::g };
+
+    for (uint32_t i{ (uint32_t)particles.size() }; i--; )
+    {
+        if (activity.isAsleep(particles[i]))
+            continue;
+
+        sf::Vector2f f_air = -1.f * params.beta * particles[i].getVelocity();
+        //sf::Vector2f f_air{ 0.f, 0.f };
+
+        particles[i].updateParticle(deltaTime, f_collisions[i], f_air + f_grav, params);
+    }
+}
+
+// Queries see the grid of the last step, so they are valid until the next call to step
+
+SpatialQuery Scene::query() const
+{
+    return SpatialQuery(grid, particles, maxDisplacement);
+}
+
+float Scene::maxSpeed() const
+{
+    return std::transform_reduce(std::execution::par, particles.begin(), particles.end(), 0.f,
+        [](float a, float b) { return std::max(a, b); },
+        [](const Particle& particle)
+        {
+            sf::Vector2f v = particle.getVelocity();
+            return std::sqrt(v.x * v.x + v.y * v.y);
+        });
+}
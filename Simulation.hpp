@@ -5,6 +5,9 @@
 #include "hashGrid.hpp"
 #include "GlobalInteraction.hpp"
 #include "WKernel.hpp"
+#include "Scene.hpp"
+#include "Observables.hpp"
+#include "ThreadPool.hpp"
 #include <sstream>
 
 class Simulation
@@ -15,29 +18,42 @@ public:
 
 private:
     void processEvents();
-    void update(sf::Time);
     void render();
     void highlightNeighborSearch();
-    void calculateTotalEnergy();
+    void printObservables();
 
 private:
     sf::RenderWindow mWindow;
     sf::Time TimePerFrame = sf::seconds(conf::dt);
-    std::vector<Particle> particles;
+    ThreadPool pool;
+    Scene scene;
     WKernel kernel;
-    HashGrid hashGrid;
+    sf::CircleShape particleShape; // Shared by every particle, only moved before each draw
+    std::vector<QueryBox> queryBoxes;
+    std::vector<uint32_t> queryResults;
+    std::vector<uint32_t> queryCounts;
     sf::Text text;
     std::ostringstream oss;
+    ObservablesPipeline observables;
 
     float tUpdate = 0.f;
     float tRender = 0.f;
 };
 
 Simulation::Simulation() : 
-    mWindow(sf::VideoMode(conf::window_size.x, conf::window_size.y), "SPH2d-Toy", sf::Style::Fullscreen), particles()
+    mWindow(sf::VideoMode(conf::window_size.x, conf::window_size.y), "SPH2d-Toy", sf::Style::Fullscreen), scene(PhysicsParams{}, std::random_device{}(), &pool)
 {
     std::cout << "TimePerFrame: " << TimePerFrame.asMicroseconds() << std::endl;
-    particles = createParticles(conf::n_particles);
+    observables.addDefaults();
+
+    particleShape.setRadius(conf::h);
+    particleShape.setOrigin(conf::h, conf::h);
+    particleShape.setFillColor(sf::Color::Blue);
+
+    // Jet filling the tank from the left wall and a drain on the right of the floor, toggled with F
+
+    scene.flow.emitters.push_back({ { 3.f * conf::h, 200.f }, { 3.f * conf::h, 260.f }, { 60.f, 0.f }, false });
+    scene.flow.sinks.push_back({ { { conf::window_size_f.x - 150.f, conf::window_size_f.y - 60.f }, conf::window_size_f }, false });
 
     static sf::Font font;
     static bool fontLoaded = false;
@@ -70,7 +86,8 @@ void Simulation::run()
             timeSinceLastUpdate -= TimePerFrame;
             processEvents();
             clockUpdate.restart();
-            update(sf::seconds(conf::tau));
+            scene.step();
+            observables.submit(scene);
 
             tUpdate = clockUpdate.restart().asMicroseconds();
         }
@@ -88,41 +105,22 @@ void Simulation::processEvents()
         if (event.type == sf::Event::Closed)
             mWindow.close();
         if (event.type == sf::Event::KeyPressed)
+        {
             if(event.key.code == sf::Keyboard::Escape)
                 mWindow.close();
-    }
-}
-
-void Simulation::update(sf::Time deltaTime)
-{
-    // Change CollisionHandler here
-
-    GlobalInteraction<GridDetector<float>, DensityCalculator, float> densityCalculator;
-
-    std::vector<float> densities = densityCalculator.handleInteraction(particles);
-
-    for (uint32_t i{ conf::n_particles }; i--; )
-    {
-        particles[i].setDensityAndPressure(densities[i]);
-    }
-
-    GlobalInteraction<GridDetector<sf::Vector2f>, SPH, sf::Vector2f> collisionHandler;
-
-    /*sf::Clock clockSPH;
-    clockSPH.restart();*/
-
-    std::vector<sf::Vector2f> f_collisions = collisionHandler.handleInteraction(particles);
-
-    //std::cout << clockSPH.restart().asMicroseconds() << std::endl;
-
-    sf::Vector2f f_grav = { 0.f, conf::m_particle * conf::g };
-
-    for (uint32_t i{ conf::n_particles }; i--; )
-    {
-        sf::Vector2f f_air = -1.f * conf::beta * particles[i].getVelocity();
-        //sf::Vector2f f_air{ 0.f, 0.f };
-
-        particles[i].updateParticle(deltaTime, f_collisions[i], f_air + f_grav);
+            if (event.key.code == sf::Keyboard::S)
+            {
+                scene.activity.enabled = !scene.activity.enabled;
+                scene.activity.wakeAll();
+            }
+            if (event.key.code == sf::Keyboard::F)
+            {
+                for (Emitter& emitter : scene.flow.emitters)
+                    emitter.enabled = !emitter.enabled;
+                for (Sink& sink : scene.flow.sinks)
+                    sink.enabled = !sink.enabled;
+            }
+        }
     }
 }
 
@@ -130,15 +128,15 @@ void Simulation::render()
 {
     mWindow.clear();
 
-    for (uint32_t i{ conf::n_particles }; i--; )
+    for (uint32_t i{ (uint32_t)scene.particles.size() }; i--; )
     {
-        particles[i].shape.setPosition(particles[i].getPosition());
-        mWindow.draw(particles[i].shape);
+        particleShape.setPosition(scene.particles[i].getPosition());
+        mWindow.draw(particleShape);
     }
 
     highlightNeighborSearch();
 
-    calculateTotalEnergy();
+    printObservables();
 
     oss << "Tiempo de update: " << tUpdate << " ms" << std::endl;
     oss << "Tiempo de render: " << tRender << " ms" << std::endl;
@@ -152,34 +150,29 @@ void Simulation::render()
 
 void Simulation::highlightNeighborSearch()
 {
-    hashGrid.clearGrid();
-    hashGrid.mapParticlesToCell(particles);
-
     sf::Vector2f mousePos = (sf::Vector2f) sf::Mouse::getPosition(mWindow);
 
-    uint32_t mouseHash = hashGrid.getHashFromPos(mousePos);
+    float x_border = mousePos.x - (int) mousePos.x % conf::cellSize;
+    float y_border = mousePos.y - (int) mousePos.y % conf::cellSize;
 
-    std::vector<uint32_t> idxs = hashGrid.getContentOfCell(mouseHash);
+    // Particles inside the cell under the mouse, from the grid of the last step
 
-    std::vector<Particle> cellParticles(idxs.size());
+    queryBoxes.assign(1, { { x_border, y_border }, { x_border + conf::cellSize, y_border + conf::cellSize } });
+    scene.query().region(queryBoxes, (uint32_t)scene.particles.size(), queryResults, queryCounts);
 
-    for ( int i=0; i<idxs.size(); i++ )
-    {
-        cellParticles[i] = particles[idxs[i]];
-    }
+    sf::CircleShape highlight;
+    highlight.setRadius(conf::h);
+    highlight.setOrigin(conf::h, conf::h);
+    highlight.setFillColor(sf::Color::Magenta);
 
-    for (auto& particle : cellParticles)
+    for (uint32_t i = 0; i < queryCounts[0]; i++)
     {
-        particle.shape.setPosition(particle.getPosition());
-        particle.shape.setFillColor(sf::Color::Magenta);
-        mWindow.draw(particle.shape);
+        highlight.setPosition(scene.particles[queryResults[i]].getPosition());
+        mWindow.draw(highlight);
     }
 
     sf::RectangleShape cellBorder;
 
-    float x_border = mousePos.x - (int) mousePos.x % conf::cellSize;
-    float y_border = mousePos.y - (int) mousePos.y % conf::cellSize;
-
     cellBorder.setPosition(x_border, y_border);
 
     cellBorder.setOutlineColor(sf::Color::Magenta);
@@ -192,15 +185,15 @@ void Simulation::highlightNeighborSearch()
     //oss << "Mouse Hash: " << mouseHash << std::endl;
 }
 
-void Simulation::calculateTotalEnergy()
+void Simulation::printObservables()
 {
-    float energy = 0.f;
+    const std::vector<Observable>& list = observables.getObservables();
 
-    for (uint32_t i{ conf::n_particles }; i--;)
+    for (uint32_t id = 0; id < list.size(); id++)
     {
-        float speed = particles[i].getVelocityMagnitude();
-        energy += conf::m_particle * (0.5 * speed * speed - conf::g * (particles[i].getPosition().y - conf::window_size_f.y));
-    }
+        TimeSeries::Point point;
 
-    oss << "Total Energy: " << energy << std::endl;
+        if (observables.series.latest(id, point))
+            oss << list[id].name << ": " << point.value << std::endl;
+    }
 }
\ No newline at end of file
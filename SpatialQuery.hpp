@@ -0,0 +1,179 @@
+#pragma once
+#include "configuration.hpp"
+#include "Particle.hpp"
+#include "hashGrid.hpp"
+#include <algorithm>
+#include <execution>
+
+// Batched queries on an already built HashGrid. Every query of a batch runs in parallel
+// and writes into caller owned buffers: query q owns results[q * maxResults, (q + 1) * maxResults)
+// and counts[q] holds how many particles matched, which can be more than maxResults.
+// The grid may be one integration old, so cells are searched with a margin of the largest
+// distance a particle moved since it was built, and never less than querySlack.
+
+struct QueryBox
+{
+    sf::Vector2f min;
+    sf::Vector2f max;
+};
+
+class SpatialQuery
+{
+public:
+    SpatialQuery(const HashGrid& grid, const std::vector<Particle>& particles, float maxDisplacement = 0.f);
+    void radius(const std::vector<sf::Vector2f>& points, float r, uint32_t maxResults, std::vector<uint32_t>& results, std::vector<uint32_t>& counts) const;
+    void region(const std::vector<QueryBox>& boxes, uint32_t maxResults, std::vector<uint32_t>& results, std::vector<uint32_t>& counts) const;
+    void nearest(const std::vector<sf::Vector2f>& points, uint32_t k, std::vector<uint32_t>& results, std::vector<uint32_t>& counts) const;
+
+private:
+    template <typename Function>
+    void forEachInCells(sf::Vector2f min, sf::Vector2f max, Function function) const;
+    static uint32_t cellX(float x);
+    static uint32_t cellY(float y);
+
+private:
+    const HashGrid& grid;
+    const std::vector<Particle>& particles;
+    float slack;
+};
+
+SpatialQuery::SpatialQuery(const HashGrid& grid, const std::vector<Particle>& particles, float maxDisplacement)
+    : grid(grid), particles(particles), slack(std::max(maxDisplacement, conf::querySlack))
+{
+}
+
+uint32_t SpatialQuery::cellX(float x)
+{
+    return (uint32_t)std::clamp(x / conf::cellSize, 0.f, conf::n_collumns - 1.f);
+}
+
+uint32_t SpatialQuery::cellY(float y)
+{
+    return (uint32_t)std::clamp(y / conf::cellSize, 0.f, conf::n_rows - 1.f);
+}
+
+template <typename Function>
+void SpatialQuery::forEachInCells(sf::Vector2f min, sf::Vector2f max, Function function) const
+{
+    for (uint32_t y = cellY(min.y - slack); y <= cellY(max.y + slack); y++)
+    {
+        for (uint32_t x = cellX(min.x - slack); x <= cellX(max.x + slack); x++)
+        {
+            for (uint32_t idx : grid.viewCell(x + conf::n_collumns * y))
+            {
+                function(idx);
+            }
+        }
+    }
+}
+
+void SpatialQuery::radius(const std::vector<sf::Vector2f>& points, float r, uint32_t maxResults, std::vector<uint32_t>& results, std::vector<uint32_t>& counts) const
+{
+    results.resize(points.size() * maxResults);
+    counts.resize(points.size());
+
+    std::for_each(std::execution::par, points.begin(), points.end(), [&](const sf::Vector2f& point)
+    {
+        size_t q = &point - points.data();
+        uint32_t count = 0;
+
+        forEachInCells(point - sf::Vector2f{ r, r }, point + sf::Vector2f{ r, r }, [&](uint32_t idx)
+        {
+            if (distance(particles[idx].getPosition(), point) > r)
+                return;
+
+            if (count < maxResults)
+                results[q * maxResults + count] = idx;
+            count++;
+        });
+        counts[q] = count;
+    });
+}
+
+void SpatialQuery::region(const std::vector<QueryBox>& boxes, uint32_t maxResults, std::vector<uint32_t>& results, std::vector<uint32_t>& counts) const
+{
+    results.resize(boxes.size() * maxResults);
+    counts.resize(boxes.size());
+
+    std::for_each(std::execution::par, boxes.begin(), boxes.end(), [&](const QueryBox& box)
+    {
+        size_t q = &box - boxes.data();
+        uint32_t count = 0;
+
+        forEachInCells(box.min, box.max, [&](uint32_t idx)
+        {
+            sf::Vector2f pos = particles[idx].getPosition();
+
+            if (pos.x < box.min.x || pos.y < box.min.y || pos.x >= box.max.x || pos.y >= box.max.y)
+                return;
+
+            if (count < maxResults)
+                results[q * maxResults + count] = idx;
+            count++;
+        });
+        counts[q] = count;
+    });
+}
+
+// Searches rings of cells around the point until no unvisited cell can hold anything closer
+// than the current k-th neighbor. Results come sorted from nearest to farthest.
+
+void SpatialQuery::nearest(const std::vector<sf::Vector2f>& points, uint32_t k, std::vector<uint32_t>& results, std::vector<uint32_t>& counts) const
+{
+    results.resize(points.size() * k);
+    counts.resize(points.size());
+
+    std::for_each(std::execution::par, points.begin(), points.end(), [&](const sf::Vector2f& point)
+    {
+        size_t q = &point - points.data();
+        thread_local std::vector<std::pair<float, uint32_t>> best; // Max-heap on distance
+        best.clear();
+
+        int32_t x_0 = cellX(point.x);
+        int32_t y_0 = cellY(point.y);
+        int32_t maxRing = std::max(conf::n_collumns, conf::n_rows);
+
+        for (int32_t ring = 0; ring <= maxRing; ring++)
+        {
+            for (int32_t y = y_0 - ring; y <= y_0 + ring; y++)
+            {
+                for (int32_t x = x_0 - ring; x <= x_0 + ring; x++)
+                {
+                    bool onRing = std::abs(x - x_0) == ring || std::abs(y - y_0) == ring;
+
+                    if (!onRing || x < 0 || y < 0 || x >= (int32_t)conf::n_collumns || y >= (int32_t)conf::n_rows)
+                        continue;
+
+                    for (uint32_t idx : grid.viewCell(x + conf::n_collumns * y))
+                    {
+                        float d = distance(particles[idx].getPosition(), point);
+
+                        if (best.size() < k)
+                        {
+                            best.push_back({ d, idx });
+                            std::push_heap(best.begin(), best.end());
+                        }
+                        else if (k > 0 && d < best.front().first)
+                        {
+                            std::pop_heap(best.begin(), best.end());
+                            best.back() = { d, idx };
+                            std::push_heap(best.begin(), best.end());
+                        }
+                    }
+                }
+            }
+
+            // Cells beyond this ring are at least ring cells away
+            if (best.size() == k && best.front().first <= (float)(ring * conf::cellSize) - slack)
+                break;
+        }
+
+        std::sort_heap(best.begin(), best.end());
+
+        for (uint32_t n = 0; n < best.size(); n++)
+        {
+            results[q * k + n] = best[n].second;
+        }
+        counts[q] = (uint32_t)best.size();
+    });
+}
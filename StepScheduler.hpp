@@ -0,0 +1,199 @@
+#pragma once
+#include "configuration.hpp"
+#include "Particle.hpp"
+#include "hashGrid.hpp"
+#include "GlobalInteraction.hpp"
+#include "ActivityTracker.hpp"
+#include "TaskGraph.hpp"
+#include "CompactState.hpp"
+
+// Runs one step as a graph of per-block tasks. The domain is split in blocks of
+// blockCells x blockCells grid cells, and each block has three tasks:
+//  - density: densities and pressures of the block's particles
+//  - force: needs the density tasks of the block and its 8 neighbors
+//  - integrate: needs the force tasks of the block and its 8 neighbors, since those read the positions it moves
+// Interactions are gathered (each particle only writes its own output) so blocks never race.
+
+class StepScheduler
+{
+public:
+    StepScheduler(ThreadPool& pool);
+    void step(std::vector<Particle>& particles, const HashGrid& grid, const PhysicsParams& params, const ActivityTracker& activity, CompactState& compact);
+
+private:
+    template <typename Output>
+    void gatherBlock(uint32_t block, const Action<Output>& action, std::vector<Output>& output_v);
+    template <typename Function>
+    void forEachParticleInBlock(uint32_t block, Function function);
+    void densityTask(uint32_t block);
+    void forceTask(uint32_t block);
+    void integrateTask(uint32_t block);
+    std::vector<uint32_t> neighborBlocks(uint32_t block) const;
+
+private:
+    ThreadPool& pool;
+    TaskGraph graph;
+    uint32_t const n_block_collumns = (conf::n_collumns + conf::blockCells - 1) / conf::blockCells;
+    uint32_t const n_block_rows = (conf::n_rows + conf::blockCells - 1) / conf::blockCells;
+
+    // State of the step being run, read by the tasks
+    std::vector<Particle>* particles = nullptr;
+    const HashGrid* grid = nullptr;
+    const ActivityTracker* activity = nullptr;
+    CompactState* compact = nullptr; // Only set in compact state mode
+    DensityCalculator densityCalculator;
+    SPH model;
+    CompactDensityCalculator compactDensityCalculator;
+    CompactSPH compactModel;
+    const Action<float>* densityAction = nullptr;
+    const Action<sf::Vector2f>* forceAction = nullptr;
+    std::vector<float> densities;
+    std::vector<sf::Vector2f> f_collisions;
+};
+
+StepScheduler::StepScheduler(ThreadPool& pool)
+    : pool(pool)
+{
+    uint32_t n_blocks = n_block_collumns * n_block_rows;
+    std::vector<uint32_t> densityTasks, forceTasks, integrateTasks;
+
+    for (uint32_t block = 0; block < n_blocks; block++)
+    {
+        densityTasks.push_back(graph.addTask([this, block] { densityTask(block); }));
+        forceTasks.push_back(graph.addTask([this, block] { forceTask(block); }));
+        integrateTasks.push_back(graph.addTask([this, block] { integrateTask(block); }));
+    }
+
+    for (uint32_t block = 0; block < n_blocks; block++)
+    {
+        for (uint32_t neighbor : neighborBlocks(block))
+        {
+            graph.addDependency(densityTasks[neighbor], forceTasks[block]);
+            graph.addDependency(forceTasks[neighbor], integrateTasks[block]);
+        }
+    }
+}
+
+void StepScheduler::step(std::vector<Particle>& new_particles, const HashGrid& new_grid, const PhysicsParams& params, const ActivityTracker& new_activity, CompactState& new_compact)
+{
+    particles = &new_particles;
+    grid = &new_grid;
+    activity = &new_activity;
+    densityCalculator.params = params;
+    model.params = params;
+    densityAction = &densityCalculator;
+    forceAction = &model;
+    compact = nullptr;
+
+    if (params.compactState)
+    {
+        compact = &new_compact;
+        compact->pack(new_particles);
+        compactDensityCalculator.params = params;
+        compactDensityCalculator.state = compact;
+        compactModel.params = params;
+        compactModel.state = compact;
+        densityAction = &compactDensityCalculator;
+        forceAction = &compactModel;
+    }
+
+    densities.assign(particles->size(), 0.f);
+    f_collisions.assign(particles->size(), { 0.f, 0.f });
+
+    graph.run(pool);
+}
+
+// Includes the block itself
+
+std::vector<uint32_t> StepScheduler::neighborBlocks(uint32_t block) const
+{
+    std::vector<uint32_t> neighbors;
+    int32_t x = block % n_block_collumns;
+    int32_t y = block / n_block_collumns;
+
+    for (int32_t dy = -1; dy <= 1; dy++)
+    {
+        for (int32_t dx = -1; dx <= 1; dx++)
+        {
+            if (x + dx < 0 || y + dy < 0 || x + dx >= (int32_t)n_block_collumns || y + dy >= (int32_t)n_block_rows)
+                continue;
+
+            neighbors.push_back((x + dx) + n_block_collumns * (y + dy));
+        }
+    }
+    return neighbors;
+}
+
+template <typename Function>
+void StepScheduler::forEachParticleInBlock(uint32_t block, Function function)
+{
+    uint32_t x_0 = block % n_block_collumns * conf::blockCells;
+    uint32_t y_0 = block / n_block_collumns * conf::blockCells;
+
+    for (uint32_t y = y_0; y < std::min(y_0 + conf::blockCells, conf::n_rows); y++)
+    {
+        for (uint32_t x = x_0; x < std::min(x_0 + conf::blockCells, conf::n_collumns); x++)
+        {
+            uint32_t hash = x + conf::n_collumns * y;
+
+            if (activity->isCellAsleep(hash))
+                continue;
+
+            for (uint32_t idx : grid->viewCell(hash))
+            {
+                function(x, y, idx);
+            }
+        }
+    }
+}
+
+template <typename Output>
+void StepScheduler::gatherBlock(uint32_t block, const Action<Output>& action, std::vector<Output>& output_v)
+{
+    forEachParticleInBlock(block, [&](uint32_t x, uint32_t y, uint32_t idx_i)
+    {
+        for (uint32_t ny = (y > 0 ? y - 1 : 0); ny <= std::min(y + 1, conf::n_rows - 1); ny++)
+        {
+            for (uint32_t nx = (x > 0 ? x - 1 : 0); nx <= std::min(x + 1, conf::n_collumns - 1); nx++)
+            {
+                for (uint32_t idx_j : grid->viewCell(nx + conf::n_collumns * ny))
+                {
+                    if (idx_j != idx_i)
+                        action.doActionOnFirst(*particles, output_v, idx_i, idx_j);
+                }
+            }
+        }
+    });
+}
+
+void StepScheduler::densityTask(uint32_t block)
+{
+    gatherBlock(block, *densityAction, densities);
+
+    forEachParticleInBlock(block, [&](uint32_t, uint32_t, uint32_t idx)
+    {
+        (*particles)[idx].setDensityAndPressure(densities[idx], densityCalculator.params);
+
+        if (compact)
+            compact->packDensityAndPressure(idx, (*particles)[idx]);
+    });
+}
+
+void StepScheduler::forceTask(uint32_t block)
+{
+    gatherBlock(block, *forceAction, f_collisions);
+}
+
+void StepScheduler::integrateTask(uint32_t block)
+{
+    sf::Time deltaTime = sf::seconds(model.params.tau());
+    sf::Vector2f f_grav = { 0.f, conf::m_particle * conf::g };
+
+    forEachParticleInBlock(block, [&](uint32_t, uint32_t, uint32_t idx)
+    {
+        Particle& particle = (*particles)[idx];
+        sf::Vector2f f_air = -1.f * model.params.beta * particle.getVelocity();
+
+        particle.updateParticle(deltaTime, f_collisions[idx], f_air + f_grav, model.params);
+    });
+}
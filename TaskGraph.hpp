@@ -0,0 +1,98 @@
+#pragma once
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Static DAG of tasks. A task is handed to the pool as soon as its last dependency
+// finishes, so there are no global barriers between phases.
+
+class TaskGraph
+{
+public:
+    uint32_t addTask(std::function<void()> work);
+    void addDependency(uint32_t before, uint32_t after);
+    void run(ThreadPool& pool);
+    size_t size() const;
+
+private:
+    struct Node
+    {
+        std::function<void()> work;
+        std::vector<uint32_t> successors;
+        uint32_t n_dependencies = 0;
+    };
+
+private:
+    void launch(ThreadPool& pool, TaskGroup& group, uint32_t id);
+
+private:
+    std::vector<Node> nodes;
+    std::unique_ptr<std::atomic<uint32_t>[]> remaining;
+    size_t n_remaining = 0;
+};
+
+uint32_t TaskGraph::addTask(std::function<void()> work)
+{
+    Node node;
+    node.work = std::move(work);
+    nodes.push_back(std::move(node));
+    return (uint32_t)nodes.size() - 1;
+}
+
+void TaskGraph::addDependency(uint32_t before, uint32_t after)
+{
+    std::vector<uint32_t>& successors = nodes[before].successors;
+
+    if (std::find(successors.begin(), successors.end(), after) != successors.end())
+        return;
+
+    successors.push_back(after);
+    nodes[after].n_dependencies++;
+}
+
+size_t TaskGraph::size() const
+{
+    return nodes.size();
+}
+
+// Blocks until every task of the graph has run
+
+void TaskGraph::run(ThreadPool& pool)
+{
+    if (n_remaining != nodes.size())
+    {
+        remaining = std::make_unique<std::atomic<uint32_t>[]>(nodes.size());
+        n_remaining = nodes.size();
+    }
+
+    for (uint32_t id = 0; id < nodes.size(); id++)
+    {
+        remaining[id] = nodes[id].n_dependencies;
+    }
+    TaskGroup group;
+
+    for (uint32_t id = 0; id < nodes.size(); id++)
+    {
+        if (nodes[id].n_dependencies == 0)
+            launch(pool, group, id);
+    }
+    pool.wait(group);
+}
+
+// Successors are submitted before the task finishes, so the group never empties early
+
+void TaskGraph::launch(ThreadPool& pool, TaskGroup& group, uint32_t id)
+{
+    pool.submit([this, &pool, &group, id] {
+        nodes[id].work();
+
+        for (uint32_t successor : nodes[id].successors)
+        {
+            if (--remaining[successor] == 0)
+                launch(pool, group, successor);
+        }
+    }, &group);
+}
@@ -0,0 +1,233 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool: every worker pops its own queue from the back and steals from the
+// front of the others when it runs dry. Tasks submitted from a worker stay on its queue.
+// Clients sharing the pool wait on their own TaskGroup, not on each other's tasks.
+
+struct TaskGroup
+{
+    std::atomic<uint64_t> pending{ 0 };
+};
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(uint32_t n_threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+    void submit(std::function<void()> task, TaskGroup* group = nullptr);
+    void wait(TaskGroup& group);
+    void wait();
+    uint32_t size() const;
+
+private:
+    struct Task
+    {
+        std::function<void()> work;
+        TaskGroup* group;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+private:
+    int32_t localQueue() const;
+    bool popTask(uint32_t idx, Task& task);
+    bool stealTask(uint32_t thief, Task& task);
+    bool runPendingTask();
+    void finishTask(TaskGroup* group);
+    void workerLoop(uint32_t idx);
+
+private:
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<uint32_t> nextQueue{ 0 };
+    std::atomic<uint64_t> queued{ 0 };
+    std::atomic<uint64_t> pending{ 0 };
+    std::atomic<bool> stop{ false };
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    static thread_local const ThreadPool* workerPool;
+    static thread_local uint32_t workerIdx;
+};
+
+thread_local const ThreadPool* ThreadPool::workerPool = nullptr;
+thread_local uint32_t ThreadPool::workerIdx = 0;
+
+ThreadPool::ThreadPool(uint32_t n_threads)
+{
+    n_threads = std::max(n_threads, 1u);
+
+    for (uint32_t i = 0; i < n_threads; i++)
+    {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (uint32_t i = 0; i < n_threads; i++)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stop = true;
+    }
+    wake.notify_all();
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+uint32_t ThreadPool::size() const
+{
+    return (uint32_t)workers.size();
+}
+
+int32_t ThreadPool::localQueue() const
+{
+    return workerPool == this ? (int32_t)workerIdx : -1;
+}
+
+void ThreadPool::submit(std::function<void()> task, TaskGroup* group)
+{
+    int32_t local = localQueue();
+    uint32_t idx = local >= 0 ? (uint32_t)local : nextQueue++ % queues.size();
+
+    pending++;
+    if (group)
+        group->pending++;
+    {
+        std::lock_guard<std::mutex> lock(queues[idx]->mutex);
+        queues[idx]->tasks.push_back({ std::move(task), group });
+        queued++;
+    }
+
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    wake.notify_one();
+}
+
+// Blocks until every task of the group has finished, running any task meanwhile. Safe to call
+// from inside a task, as long as that task is not in the group itself.
+
+void ThreadPool::wait(TaskGroup& group)
+{
+    while (group.pending > 0)
+    {
+        if (runPendingTask())
+            continue;
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        done.wait_for(lock, std::chrono::microseconds(100), [this, &group] { return group.pending == 0 || queued > 0; });
+    }
+}
+
+// Blocks until every submitted task has finished. From a worker it would wait on its own task
+
+void ThreadPool::wait()
+{
+    assert(localQueue() < 0);
+
+    while (pending > 0)
+    {
+        if (runPendingTask())
+            continue;
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        done.wait_for(lock, std::chrono::microseconds(100), [this] { return pending == 0 || queued > 0; });
+    }
+}
+
+bool ThreadPool::popTask(uint32_t idx, Task& task)
+{
+    std::lock_guard<std::mutex> lock(queues[idx]->mutex);
+
+    if (queues[idx]->tasks.empty())
+        return false;
+
+    task = std::move(queues[idx]->tasks.back());
+    queues[idx]->tasks.pop_back();
+    queued--;
+    return true;
+}
+
+bool ThreadPool::stealTask(uint32_t thief, Task& task)
+{
+    for (uint32_t offset = 1; offset <= queues.size(); offset++)
+    {
+        WorkQueue& victim = *queues[(thief + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if (victim.tasks.empty())
+            continue;
+
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::runPendingTask()
+{
+    Task task;
+    int32_t local = localQueue();
+    uint32_t idx = local >= 0 ? (uint32_t)local : 0;
+
+    if (!(local >= 0 && popTask(idx, task)) && !stealTask(idx, task))
+        return false;
+
+    task.work();
+    finishTask(task.group);
+    return true;
+}
+
+void ThreadPool::finishTask(TaskGroup* group)
+{
+    bool groupDone = group && --group->pending == 0;
+
+    if (--pending == 0 || groupDone)
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        done.notify_all();
+    }
+}
+
+void ThreadPool::workerLoop(uint32_t idx)
+{
+    workerPool = this;
+    workerIdx = idx;
+
+    while (true)
+    {
+        if (runPendingTask())
+            continue;
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stop || queued > 0; });
+
+        if (stop)
+            return;
+    }
+}
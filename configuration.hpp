@@ -1,5 +1,11 @@
 #pragma once
 
+enum class Solver
+{
+	WCSPH, // Weakly compressible, Tait equation of state
+	PCISPH // Predictive-corrective incompressible
+};
+
 namespace conf
 {
 	// Window configuration
@@ -12,7 +18,8 @@ namespace conf
 	float const m_particle = 5.f;
 	float const h = 10.f;
 	sf::Color particle_color = sf::Color::Blue;
-	uint32_t const n_particles = 1500;
+	uint32_t const n_particles = 1500; // Initial lattice
+	uint32_t const max_particles = 6000; // Reserved up front, emitters stop spawning beyond it
 	float const v_lineal_max = 10.f;
 
 	// Physical parameters
@@ -27,6 +34,19 @@ namespace conf
 	float const gamma = 7.f; // Polytropic coefficient (7 for water)
 	float const alpha_v = 100.f; // Viscosity Coefficient 
 
+	// Pressure solver
+	Solver const solver = Solver::WCSPH;
+	float const pcisphTauFactor = 5.f; // Longest PCISPH step relative to tau
+	float const pcisphCourant = 0.3f; // Max distance the fastest particle moves in one PCISPH step, relative to h
+	float const pcisphTolerance = 0.01f; // Max relative density error before the corrections stop
+	uint32_t const pcisphMinIterations = 3;
+	uint32_t const pcisphMaxIterations = 50;
+	uint32_t const pcisphMaxNeighbors = 64;
+
+	// Compact state
+	bool const compactState = false; // Pair kernels read packed 14 byte records kept next to Particle, so it adds 14 B per particle and steps about 15 % slower
+	uint32_t const compactOffsetScale = 16384; // Fixed point units per grid cell of the packed positions
+
 	// Hash Grid parameteres
 	uint32_t const cellSize = 50;
 	uint32_t const n_collumns = std::ceil(window_size_f.x / cellSize);
@@ -34,6 +54,65 @@ namespace conf
 	uint32_t const hashMapSize = 100000; //At least larger than numberOfCells.x * numberOfCells.y, in video PixelPhysics uses this
 	uint32_t const prime_x = 6614058611;
 	uint32_t const prime_y = 7528850467;
+
+	// Step scheduler
+	uint32_t const blockCells = 4; // Block side in grid cells, the unit of work of the step task graph
+
+	// Spatial queries
+	float const querySlack = 0.5f * h; // Least search margin, queries add the last step's largest displacement since the grid was built before it
+	float const queryCheckInterval = 0.25f; // Seconds between brute force comparisons of --query-check
+
+	// Observables
+	uint32_t const observablesCadence = 10; // Steps between diagnostic samples
+	size_t const observablesHistory = 4096; // Samples kept per observable
+	float const surfaceDensityRatio = 0.5f; // Particles below this fraction of the median density are splashes, not surface
+
+	// Sleeping cells
+	bool const sleepEnabled = true;
+	float const sleepVelocity = 0.02f * v_lineal_max; // Below this averaged speed a particle counts as resting
+	float const sleepAcceleration = 0.05f * g; // Max averaged change of acceleration per step for a resting particle
+	uint32_t const sleepSteps = 60; // Quiet steps before a cell goes to sleep, also the averaging window
+	uint32_t const sleepAuditInterval = 200; // Steps between full density solves to measure the sleeping error
+
+	// Emitters and sinks
+	float const emitterSpacing = 2.f * h; // Distance between spawned particles, along the emitter and from the fluid in front
+	uint32_t const emitterProbeResults = 8; // Neighbors read back per spawn point by the free space probe
+
+	// Ensemble runs
+	uint32_t const ensembleSeed = 12345; // Same initial lattice for every scene so only the parameters differ
+	float const ensembleSimSeconds = 5.f;
+	float const compactCheckSeconds = 25.f; // Long enough for the column to settle into contact, short of the chaotic regime
+	float const solverCheckSeconds = 60.f; // Time for the PCISPH pool to settle at beta 1
+	float const sleepCheckSeconds = 30.f; // Time measured by --sleep-check once the pool has settled
+	float const scalingCheckSeconds = 10.f; // Simulated time per run of --scaling-check
+}
+
+// Parameters that can change between scenes of the same run. Defaults come from conf
+
+struct PhysicsParams
+{
+	float alpha = conf::alpha;
+	float beta = conf::beta;
+	float k = conf::k;
+	float alpha_v = conf::alpha_v;
+	float gamma = conf::gamma;
+	float h = conf::h;
+	Solver solver = conf::solver;
+	bool compactState = conf::compactState; // WCSPH only, the pressure solver keeps its own neighbor lists
+
+	float rho_0() const;
+	float tau() const;
+};
+
+float PhysicsParams::rho_0() const
+{
+	return conf::m_particle / (3.14159 * h * h);
+}
+
+float PhysicsParams::tau() const
+{
+	float tau_wcsph = 0.2 * h / conf::v_max;
+	return solver == Solver::PCISPH ? conf::pcisphTauFactor * tau_wcsph : tau_wcsph;
 }
 
 float distance(const sf::Vector2f& v1, const sf::Vector2f& v2) {
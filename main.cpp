@@ -1,8 +1,346 @@
 #include <iostream>
+#include <fstream>
+#include <cstring>
 #include "Simulation.hpp"
+#include "Ensemble.hpp"
 
-int main()
+// Same sweep as the manual runs in Notes/Collisions.txt, headless and in parallel
+
+void runEnsemble()
+{
+    ThreadPool pool;
+    Ensemble ensemble(pool);
+
+    Sweep sweep;
+    sweep.alpha = { 0.3f, 0.99f, 1.f };
+    sweep.beta = { 0.f, 0.01f, 0.1f, 15.f };
+    ensemble.add(sweep);
+
+    sf::Clock clock;
+    std::vector<EnsembleResult> results = ensemble.run(conf::ensembleSimSeconds);
+    float elapsed = clock.restart().asSeconds();
+
+    std::ofstream file("ensemble_results.csv");
+    ensemble.writeTable(file, results);
+    ensemble.writeTable(std::cout, results);
+
+    std::cout << results.size() << " scenes on " << pool.size() << " threads in " << elapsed << " s" << std::endl;
+}
+
+// Every scene runs twice from the same lattice, with full precision and with compact state,
+// and the total energies are compared. Past compactCheckSeconds the WCSPH flow is chaotic
+// enough that any perturbation, even one fixed point step of the positions, drifts as much.
+
+void runCompactCheck()
+{
+    ThreadPool pool;
+    Ensemble ensemble(pool);
+
+    for (float alpha : { conf::alpha, 1.f })
+    {
+        PhysicsParams params;
+        params.alpha = alpha;
+        ensemble.add(params);
+
+        params.compactState = true;
+        ensemble.add(params);
+    }
+
+    std::vector<EnsembleResult> results = ensemble.run(conf::compactCheckSeconds);
+    ensemble.writeTable(std::cout, results);
+
+    std::vector<std::string> names = ensemble.getObservableNames();
+    uint32_t energy = (uint32_t)(std::find(names.begin(), names.end(), "Total Energy") - names.begin());
+
+    for (uint32_t i = 0; i + 1 < results.size(); i += 2)
+    {
+        float full = results[i].values[energy];
+        float compact = results[i + 1].values[energy];
+
+        std::cout << "alpha " << results[i].params.alpha << ": total energy " << full << " full, " << compact << " compact, "
+                  << 100.f * std::abs(compact - full) / std::abs(full) << " % apart" << std::endl;
+    }
+}
+
+// WCSPH and PCISPH from the same lattice and aiming at the same rho_0, with the default drag and with
+// beta 1, where the pool settles. One scene at a time so the wall times can be compared.
+
+void runSolverCheck()
+{
+    ThreadPool pool(1);
+    Ensemble ensemble(pool);
+
+    for (float beta : { conf::beta, 1.f })
+    {
+        for (Solver solver : { Solver::WCSPH, Solver::PCISPH })
+        {
+            PhysicsParams params;
+            params.beta = beta;
+            params.solver = solver;
+            ensemble.add(params);
+        }
+    }
+
+    std::vector<EnsembleResult> results = ensemble.run(conf::solverCheckSeconds);
+
+    std::vector<std::string> names = ensemble.getObservableNames();
+    uint32_t densityError = (uint32_t)(std::find(names.begin(), names.end(), "Density Error") - names.begin());
+    uint32_t surfaceHeight = (uint32_t)(std::find(names.begin(), names.end(), "Free Surface Height") - names.begin());
+
+    for (const auto& result : results)
+    {
+        std::cout << (result.params.solver == Solver::PCISPH ? "PCISPH" : "WCSPH") << " beta " << result.params.beta << ": "
+                  << result.steps << " steps of " << 1000.f * result.simTime / result.steps << " ms on average, "
+                  << 1000.f * result.wallTime / result.simTime << " ms of wall time per simulated second, density error "
+                  << 100.f * result.values[densityError] << " %, free surface at " << result.values[surfaceHeight] << " px";
+
+        if (result.diverged)
+            std::cout << ", diverged at " << result.divergedTime << " s";
+        std::cout << std::endl;
+    }
+}
+
+// The settled PCISPH pool of --solver-check, stepped on with sleeping cells on and off.
+// Only the steps after it has settled are timed.
+
+void runSleepCheck()
+{
+    for (bool sleeping : { true, false })
+    {
+        PhysicsParams params;
+        params.beta = 1.f;
+        params.solver = Solver::PCISPH;
+        Scene scene(params, conf::ensembleSeed);
+        scene.activity.enabled = sleeping;
+
+        while (scene.time < conf::solverCheckSeconds)
+        {
+            scene.step();
+        }
+
+        float sleepingSum = 0.f;
+        float maxAuditError = 0.f;
+        uint64_t startStep = scene.stepCount;
+        sf::Clock clock;
+
+        while (scene.time < conf::solverCheckSeconds + conf::sleepCheckSeconds)
+        {
+            scene.step();
+            sleepingSum += scene.activity.sleepingFraction((uint32_t)scene.particles.size());
+            maxAuditError = std::max(maxAuditError, scene.activity.auditError);
+        }
+
+        float wallTime = clock.restart().asSeconds();
+        uint64_t steps = scene.stepCount - startStep;
+
+        std::cout << "Sleeping " << (sleeping ? "on" : "off") << ": " << 100.f * sleepingSum / steps << " % of the particles asleep on average, "
+                  << 100.f * scene.activity.sleepingFraction((uint32_t)scene.particles.size()) << " % at the end, audit error up to "
+                  << 100.f * maxAuditError << " % of rho_0, " << 1000.f * wallTime / steps << " ms per step over " << steps << " steps" << std::endl;
+    }
+}
+
+// The default WCSPH scene stepped serially and through the step scheduler on pools of 1, 2, 4
+// and every hardware thread. Same seed, so the scheduled runs also report how far they drift.
+
+void runScalingCheck()
+{
+    std::vector<uint32_t> threads{ 0, 1, 2, 4 };
+    uint32_t hardware = std::thread::hardware_concurrency();
+    if (std::find(threads.begin(), threads.end(), hardware) == threads.end())
+        threads.push_back(hardware);
+
+    std::vector<Particle> serial;
+    float serialTime = 0.f;
+
+    for (uint32_t n_threads : threads)
+    {
+        std::unique_ptr<ThreadPool> pool;
+        if (n_threads > 0)
+            pool = std::make_unique<ThreadPool>(n_threads);
+
+        Scene scene(PhysicsParams{}, conf::ensembleSeed, pool.get());
+        sf::Clock clock;
+
+        while (scene.time < conf::scalingCheckSeconds)
+        {
+            scene.step();
+        }
+
+        float wallTime = clock.restart().asSeconds();
+
+        if (n_threads == 0)
+        {
+            serial = scene.particles;
+            serialTime = wallTime;
+            std::cout << "Serial: " << 1000.f * wallTime / scene.stepCount << " ms per step over " << scene.stepCount << " steps" << std::endl;
+            continue;
+        }
+
+        float drift = 0.f;
+        for (uint32_t i = 0; i < std::min(serial.size(), scene.particles.size()); i++)
+        {
+            drift = std::max(drift, distance(serial[i].getPosition(), scene.particles[i].getPosition()));
+        }
+
+        std::cout << n_threads << " threads: " << 1000.f * wallTime / scene.stepCount << " ms per step, " << serialTime / wallTime
+                  << "x the serial speed, positions up to " << drift << " px from the serial run" << std::endl;
+    }
+    std::cout << hardware << " hardware threads" << std::endl;
+}
+
+// Radius, nearest and region queries against a brute force search over every particle, every
+// queryCheckInterval seconds of each scene. The grid is one step old, so this checks the search
+// margin. A scene that goes non finite stops there.
+
+void countQueryMismatches(const Scene& scene, const std::vector<sf::Vector2f>& points, uint32_t mismatches[3])
+{
+    SpatialQuery query = scene.query();
+    std::vector<uint32_t> results, counts;
+    float radius = 2.f * scene.params.h;
+    uint32_t k = 5;
+
+    query.radius(points, radius, (uint32_t)scene.particles.size(), results, counts);
+
+    for (uint32_t q = 0; q < points.size(); q++)
+    {
+        uint32_t count = 0;
+        for (const auto& particle : scene.particles)
+        {
+            if (distance(particle.getPosition(), points[q]) <= radius)
+                count++;
+        }
+        if (count != counts[q])
+            mismatches[0]++;
+    }
+
+    query.nearest(points, k, results, counts);
+
+    for (uint32_t q = 0; q < points.size(); q++)
+    {
+        std::vector<float> d;
+        for (const auto& particle : scene.particles)
+        {
+            d.push_back(distance(particle.getPosition(), points[q]));
+        }
+        std::partial_sort(d.begin(), d.begin() + k, d.end());
+
+        for (uint32_t n = 0; n < k; n++)
+        {
+            if (distance(scene.particles[results[q * k + n]].getPosition(), points[q]) != d[n])
+            {
+                mismatches[1]++;
+                break;
+            }
+        }
+    }
+
+    std::vector<QueryBox> boxes;
+    for (const auto& point : points)
+    {
+        boxes.push_back({ point, point + sf::Vector2f{ 2.f * radius, 2.f * radius } });
+    }
+    query.region(boxes, (uint32_t)scene.particles.size(), results, counts);
+
+    for (uint32_t q = 0; q < boxes.size(); q++)
+    {
+        uint32_t count = 0;
+        for (const auto& particle : scene.particles)
+        {
+            sf::Vector2f pos = particle.getPosition();
+            if (pos.x >= boxes[q].min.x && pos.y >= boxes[q].min.y && pos.x < boxes[q].max.x && pos.y < boxes[q].max.y)
+                count++;
+        }
+        if (count != counts[q])
+            mismatches[2]++;
+    }
+}
+
+void runQueryCheck()
+{
+    std::mt19937 gen(conf::ensembleSeed);
+    std::uniform_real_distribution<float> dis(0.f, 1.f);
+
+    std::vector<sf::Vector2f> points(500);
+    for (auto& point : points)
+    {
+        point = { dis(gen) * conf::window_size_f.x, dis(gen) * conf::window_size_f.y };
+    }
+
+    for (Solver solver : { Solver::WCSPH, Solver::PCISPH })
+    {
+        for (float beta : { conf::beta, 0.1f })
+        {
+            PhysicsParams params;
+            params.solver = solver;
+            params.beta = beta;
+            Scene scene(params, conf::ensembleSeed);
+
+            uint32_t mismatches[3] = { 0, 0, 0 };
+            uint32_t checks = 0;
+            float maxDisplacement = 0.f;
+            float nextCheck = conf::queryCheckInterval;
+
+            while (scene.time < conf::ensembleSimSeconds)
+            {
+                scene.step();
+
+                if (!Ensemble::isFinite(scene.particles))
+                    break;
+
+                maxDisplacement = std::max(maxDisplacement, scene.maxDisplacement);
+
+                if (scene.time >= nextCheck)
+                {
+                    countQueryMismatches(scene, points, mismatches);
+                    checks++;
+                    nextCheck += conf::queryCheckInterval;
+                }
+            }
+
+            std::cout << (solver == Solver::PCISPH ? "PCISPH" : "WCSPH") << " beta " << beta << ": " << mismatches[0] << " radius, "
+                      << mismatches[1] << " nearest, " << mismatches[2] << " region mismatches in " << checks << " x " << points.size()
+                      << " queries, largest step displacement " << maxDisplacement << " px";
+
+            if (scene.time < conf::ensembleSimSeconds)
+                std::cout << ", diverged at " << scene.time << " s";
+            std::cout << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv)
 {
+    if (argc > 1 && std::strcmp(argv[1], "--ensemble") == 0)
+    {
+        runEnsemble();
+        return 0;
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--compact-check") == 0)
+    {
+        runCompactCheck();
+        return 0;
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--solver-check") == 0)
+    {
+        runSolverCheck();
+        return 0;
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--sleep-check") == 0)
+    {
+        runSleepCheck();
+        return 0;
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--query-check") == 0)
+    {
+        runQueryCheck();
+        return 0;
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--scaling-check") == 0)
+    {
+        runScalingCheck();
+        return 0;
+    }
+
     Simulation simulation;
     std::cout << "deltaT in Simulation: " << conf::tau * 1000000 << std::endl;
     simulation.run();